@@ -0,0 +1,210 @@
+// capture.c
+//
+// Binary capture of the traffic arriving on /server_queue, so real command mixes
+// can be played back later with ./replay, plus the shared counters replay uses to
+// see what the server actually ran.
+// Recording is on the ingestion thread's path, so it is kept cheap: one
+// clock_gettime() and a few buffered fwrite()s per message, nothing is flushed
+// until the 1MB stdio buffer fills up or the server shuts down.
+
+#include "prototype_defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+static FILE* g_captureFile = NULL;
+static char* g_captureBuffer = NULL;
+static struct timespec g_captureStart;
+static unsigned long g_captureRecords = 0;
+
+/**
+ * capture_open()
+ * Creates the capture file and writes its header.
+ */
+int capture_open(const char* path)
+{
+    g_captureFile = fopen(path, "wb");
+    if (!g_captureFile) {
+        perror("fopen for capture file failed");
+        return -1;
+    }
+
+    // Big stdio buffer so the hot path almost never hits write(2)
+    g_captureBuffer = (char*)malloc(CAPTURE_BUFFER_SIZE);
+    if (g_captureBuffer) {
+        setvbuf(g_captureFile, g_captureBuffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+    }
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_gettime(CLOCK_MONOTONIC, &g_captureStart);
+
+    uint32_t version = CAPTURE_VERSION;
+    int64_t start_ns = (int64_t)wall.tv_sec * 1000000000LL + wall.tv_nsec;
+    fwrite(CAPTURE_MAGIC, 1, 4, g_captureFile);
+    fwrite(&version, sizeof(version), 1, g_captureFile);
+    fwrite(&start_ns, sizeof(start_ns), 1, g_captureFile);
+
+    g_captureRecords = 0;
+    return 0;
+}
+
+/**
+ * capture_write()
+ * Appends one record, stamped with its arrival offset. No-op when not recording.
+ */
+void capture_write(MyMessage* msg)
+{
+    if (!g_captureFile) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t offset_ns = (uint64_t)(now.tv_sec - g_captureStart.tv_sec) * 1000000000ULL +
+                         (uint64_t)(now.tv_nsec - g_captureStart.tv_nsec);
+    int64_t pid = msg->client_pid;
+    uint16_t len = (uint16_t)strnlen(msg->content, sizeof(msg->content) - 1);
+
+    fwrite(&offset_ns, sizeof(offset_ns), 1, g_captureFile);
+    fwrite(&pid, sizeof(pid), 1, g_captureFile);
+    fwrite(&len, sizeof(len), 1, g_captureFile);
+    fwrite(msg->content, 1, len, g_captureFile);
+    g_captureRecords++;
+}
+
+/**
+ * capture_close()
+ * Flushes whatever is still buffered and closes the file.
+ */
+void capture_close(void)
+{
+    if (!g_captureFile) {
+        return;
+    }
+    fclose(g_captureFile);
+    g_captureFile = NULL;
+    free(g_captureBuffer);
+    g_captureBuffer = NULL;
+
+    printf("[capture]: Recorded %lu messages.\n", g_captureRecords);
+}
+
+/**
+ * capture_open_reader()
+ * Opens a capture file for replay and skips past its header.
+ */
+FILE* capture_open_reader(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        perror("fopen for capture file failed");
+        return NULL;
+    }
+
+    char magic[4];
+    uint32_t version = 0;
+    int64_t start_ns = 0;
+    if (fread(magic, 1, 4, fp) != 4 ||
+        fread(&version, sizeof(version), 1, fp) != 1 ||
+        fread(&start_ns, sizeof(start_ns), 1, fp) != 1 ||
+        memcmp(magic, CAPTURE_MAGIC, 4) != 0 ||
+        version != CAPTURE_VERSION) {
+        fprintf(stderr, "capture_open_reader: '%s' is not a version %d capture file\n",
+                path, CAPTURE_VERSION);
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+/**
+ * capture_read()
+ * Reads the next record into 'out' (content is always NUL terminated).
+ */
+int capture_read(FILE* fp, CaptureRecord* out)
+{
+    uint64_t offset_ns;
+    int64_t pid;
+    uint16_t len;
+
+    if (fread(&offset_ns, sizeof(offset_ns), 1, fp) != 1) {
+        return feof(fp) ? 0 : -1;
+    }
+    if (fread(&pid, sizeof(pid), 1, fp) != 1 ||
+        fread(&len, sizeof(len), 1, fp) != 1 ||
+        len >= sizeof(out->content) ||
+        fread(out->content, 1, len, fp) != len) {
+        fprintf(stderr, "capture_read: truncated or corrupt record\n");
+        return -1;
+    }
+
+    out->content[len] = '\0';
+    out->offset_ns = offset_ns;
+    out->client_pid = (long)pid;
+    return 1;
+}
+
+/**
+ * counters_create()
+ * Server side. A taken-over server reuses the segment, so the counts carry on.
+ */
+ServerCounters* counters_create(void)
+{
+    int fd = shm_open(COUNTERS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    if (fd == -1) {
+        perror("shm_open for server counters failed");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(ServerCounters)) == -1) {
+        perror("ftruncate for server counters failed");
+        close(fd);
+        return NULL;
+    }
+    void* mem = mmap(NULL, sizeof(ServerCounters), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror("mmap for server counters failed");
+        return NULL;
+    }
+    return (ServerCounters*)mem;
+}
+
+/**
+ * counters_attach()
+ * ./replay side, read-only.
+ */
+const ServerCounters* counters_attach(void)
+{
+    int fd = shm_open(COUNTERS_SHM_NAME, O_RDONLY, 0);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror("shm_open for server counters failed");
+        }
+        return NULL;
+    }
+    void* mem = mmap(NULL, sizeof(ServerCounters), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror("mmap for server counters failed");
+        return NULL;
+    }
+    return (const ServerCounters*)mem;
+}
+
+void counters_close(const ServerCounters* counters, int unlink_on_close)
+{
+    if (counters) {
+        munmap((void*)counters, sizeof(ServerCounters));
+    }
+    if (unlink_on_close) {
+        shm_unlink(COUNTERS_SHM_NAME);
+    }
+}
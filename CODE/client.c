@@ -7,6 +7,21 @@
 #include "prototype_defs.h"
 
 static MyMessageQueue* g_incoming_queue = NULL;
+static unsigned long g_corr_seq = 0;
+
+// Stamps the message with a fresh correlation ID (client pid + sequence number),
+// sends it, and records the "enqueue" span when tracing is on
+int send_command(MyMessage* msg) {
+    msg->corr_id = ((unsigned long)msg->client_pid << 32) | ++g_corr_seq;
+    msg->received_us = 0;
+    trace_set_correlation(msg->corr_id);
+
+    unsigned long long start = trace_now_us();
+    trace_flow('s', start);
+    int rc = enqueue_message(g_incoming_queue, msg);
+    trace_span("enqueue", "client", start, trace_now_us());
+    return rc;
+}
 
 void* shutdown_listener_thread(void* arg) {
     // Example: in a real design,we could create a separate broadcast queue just for SHUTDOWN
@@ -25,11 +40,28 @@ void* shutdown_listener_thread(void* arg) {
     return NULL;
 }
 
-int main(void) {
+int main(int argc, char* argv[]) {
     pid_t client_pid = getpid();
     pid_t parent_pid = getppid();
     pthread_t main_thread = pthread_self();
 
+    // Optional: --trace <file> writes Chrome trace spans (can be the same file as the server's)
+    //           --admin sends to the server's admin queue, the only place CONFIG/WEIGHT/LIMIT are accepted
+    int admin = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--admin") == 0) {
+            admin = 1;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            if (tracing_open(argv[++i]) == -1) {
+                exit(1);
+            }
+            trace_thread_name("client main");
+        } else {
+            fprintf(stderr, "Usage: %s [--admin] [--trace <trace file>]\n", argv[0]);
+            exit(1);
+        }
+    }
+
     // Print banner similar to instructor's reference
     printf("|----------------------------------------------------------------------------------------------|\n"
            "|------------------------ THIS IS AN INTERPROCESS SHELL SERVER --------------------------------|\n"
@@ -50,25 +82,39 @@ int main(void) {
     }
 
     // 2) Create (or open) the same queue as server so we can send commands to server
-    g_incoming_queue = create_custom_queue("/server_queue", 10); // referring to the exact same kernel-level message queue object as server.c
+    //    (the admin queue only ever comes from the server, and only its user may open it)
+    if (admin) {
+        g_incoming_queue = open_existing_queue(ADMIN_QUEUE_NAME);
+    } else {
+        g_incoming_queue = create_custom_queue("/server_queue", 10); // referring to the exact same kernel-level message queue object as server.c
+    }
     if (!g_incoming_queue) {
         fprintf(stderr, "[Main Thread -- %lu]: ERROR opening server queue!\n",
                 (unsigned long)main_thread);
         exit(1);
     }
 
-    // 1) Send "REGISTER" to server so it can track client as visible
-    MyMessage regMsg;
-    regMsg.client_pid = client_pid;
-    snprintf(regMsg.content, sizeof(regMsg.content), "REGISTER");
-    enqueue_message(g_incoming_queue, &regMsg);
+    // 1) Send "REGISTER" to server so it can track client as visible (admin sessions don't run commands)
+    if (!admin) {
+        MyMessage regMsg;
+        regMsg.client_pid = client_pid;
+        snprintf(regMsg.content, sizeof(regMsg.content), "REGISTER");
+        send_command(&regMsg);
+    }
 
     printf("[Main Thread -- %lu]: Client initialized. Enter commands (type 'EXIT' to quit)...\n\n",
            (unsigned long)main_thread);
 
     // 3) Simple REPL (read-eval-print loop): read user input, send messages to server
     char input[256];
+    char line[256];
     char prompt[256] = "Enter Command";
+    char saved_prompt[256];
+
+    // BATCH mode: lines typed after "BATCH [-e] [-p]" are collected until "END"
+    // and go to the server as one message
+    int in_batch = 0;
+    MyMessage batchMsg;
     while (1) {
 
         printf("%s> ", prompt);
@@ -88,6 +134,37 @@ int main(void) {
             continue;
         }
 
+        if (in_batch) {
+            if (strcmp(input, "END") == 0) {
+                send_command(&batchMsg);
+                in_batch = 0;
+                snprintf(prompt, sizeof(prompt), "%s", saved_prompt);
+                printf("======================================================\n");
+                continue;
+            }
+            size_t used = strlen(batchMsg.content);
+            if (used + strlen(input) + 2 > sizeof(batchMsg.content)) {
+                printf("Batch is full (%zu bytes), type END to send it.\n", sizeof(batchMsg.content));
+                continue;
+            }
+            snprintf(batchMsg.content + used, sizeof(batchMsg.content) - used, "\n%s", input);
+            continue;
+        }
+
+        if (strncmp(input, "BATCH", 5) == 0 && (input[5] == '\0' || input[5] == ' ')) {
+            memset(&batchMsg, 0, sizeof(batchMsg));
+            batchMsg.client_pid = client_pid;
+            snprintf(batchMsg.content, sizeof(batchMsg.content), "%s", input); // keeps the -e / -p flags
+            in_batch = 1;
+            snprintf(saved_prompt, sizeof(saved_prompt), "%s", prompt); // put it back after END
+            snprintf(prompt, sizeof(prompt), "BATCH");
+            printf("Enter one command per line, END sends the batch.\n");
+            continue;
+        }
+
+        // keep the whole line, strtok below cuts 'input' at the first space
+        snprintf(line, sizeof(line), "%s", input);
+
         // --- Parse the input to check commands ---
         // One simple approach: split at first space
         // "CHPT myPrompt" -> cmd="CHPT", arg="myPrompt"
@@ -95,12 +172,15 @@ int main(void) {
         char *arg = strtok(NULL, "");      // the rest of the line
 
         if (strcmp(input, "EXIT") == 0) {
-            // Send EXIT to server, then break
+            // Send EXIT to server, then break (an admin session never registered)
+            if (admin) {
+                break;
+            }
             MyMessage msg;
             msg.client_pid = client_pid;
             snprintf(msg.content, sizeof(msg.content), "%s", "EXIT");
 
-            enqueue_message(g_incoming_queue, &msg);
+            send_command(&msg);
 
             printf("[Main Thread -- %lu]: Exiting on user command...\n", (unsigned long)main_thread);
             break;
@@ -118,12 +198,12 @@ int main(void) {
             continue;
         }
 
-        // else send it as is
+        // else send the whole line as is
         MyMessage msg;
         msg.client_pid = client_pid;
-        snprintf(msg.content, sizeof(msg.content), "%s", input);
+        snprintf(msg.content, sizeof(msg.content), "%s", line);
 
-        enqueue_message(g_incoming_queue, &msg);
+        send_command(&msg);
 
         // For demonstration, pretend we read back a response from the server on a separate queue
         // In a real system, you'd likely have a separate client-specific queue to read server's response
@@ -141,6 +221,7 @@ int main(void) {
     }
 
     destroy_message_queue(g_incoming_queue, 0); // don't unlink
+    tracing_close();
     printf("[Main Thread -- %lu]: Resource cleanup complete. Shutting down...\n",
            (unsigned long)main_thread);
 
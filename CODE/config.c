@@ -0,0 +1,195 @@
+// config.c
+//
+// Server settings that used to be hard-coded (queue depth, 3 second shell timeout,
+// 100ms poll interval, MAX_CLIENTS, worker count...). They start at the old values,
+// can be loaded from a file at startup and changed on a live server with CONFIG.
+// Readers always take a snapshot, so a command sees one consistent set of values.
+
+#include "prototype_defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <pthread.h>
+
+static ServerConfig g_config = {
+    SCHED_WORKER_COUNT,
+    DEFAULT_QUEUE_DEPTH,
+    SCHED_LANE_CAPACITY,
+    DEFAULT_SHELL_TIMEOUT_MS,
+    DEFAULT_POLL_INTERVAL_MS,
+    MAX_CLIENTS,
+    SCHED_DEFAULT_WEIGHT,
+    SCHED_DEFAULT_MAX_INFLIGHT,
+    SCHED_DEFAULT_RATE,
+    DEFAULT_DRAIN_TIMEOUT_MS
+};
+static pthread_mutex_t g_configLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * One entry per setting: where it lives in ServerConfig and which values are allowed.
+ */
+typedef struct {
+    const char* key;
+    size_t offset;
+    int is_double;
+    double min;
+    double max;
+} ConfigKey;
+
+static const ConfigKey g_configKeys[] = {
+    { "worker_count",         offsetof(ServerConfig, worker_count),         0, 1, SCHED_MAX_WORKERS },
+    { "queue_depth",          offsetof(ServerConfig, queue_depth),          0, 1, 10000 },
+    { "lane_depth",           offsetof(ServerConfig, lane_depth),           0, 1, SCHED_LANE_CAPACITY },
+    { "shell_timeout_ms",     offsetof(ServerConfig, shell_timeout_ms),     0, 1, 3600000 },
+    { "poll_interval_ms",     offsetof(ServerConfig, poll_interval_ms),     0, 1, 10000 },
+    { "max_clients",          offsetof(ServerConfig, max_clients),          0, 1, MAX_CLIENTS },
+    { "default_weight",       offsetof(ServerConfig, default_weight),       0, 1, 1000 },
+    { "default_max_inflight", offsetof(ServerConfig, default_max_inflight), 0, 1, SCHED_MAX_WORKERS },
+    { "default_rate",         offsetof(ServerConfig, default_rate),         1, 0, 1000000 },
+    { "drain_timeout_ms",     offsetof(ServerConfig, drain_timeout_ms),     0, 0, 3600000 },
+};
+#define NUM_CONFIG_KEYS (sizeof(g_configKeys) / sizeof(g_configKeys[0]))
+
+ServerConfig config_snapshot(void)
+{
+    pthread_mutex_lock(&g_configLock);
+    ServerConfig copy = g_config;
+    pthread_mutex_unlock(&g_configLock);
+    return copy;
+}
+
+/**
+ * config_set()
+ * Parses 'value' for 'key', checks it against the key's range and stores it.
+ */
+int config_set(const char* key, const char* value)
+{
+    const ConfigKey* entry = NULL;
+    for (size_t i = 0; i < NUM_CONFIG_KEYS; i++) {
+        if (strcmp(g_configKeys[i].key, key) == 0) {
+            entry = &g_configKeys[i];
+            break;
+        }
+    }
+    if (!entry) {
+        fprintf(stderr, "config_set: unknown setting '%s'\n", key);
+        return -1;
+    }
+
+    char* end = NULL;
+    double number = strtod(value, &end);
+    if (end == value || *end != '\0' ||
+        (!entry->is_double && number != (double)(long)number) ||
+        number < entry->min || number > entry->max) {
+        fprintf(stderr, "config_set: bad value '%s' for %s (allowed %g..%g%s)\n",
+                value, key, entry->min, entry->max, entry->is_double ? "" : ", whole numbers");
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_configLock);
+    char* field = (char*)&g_config + entry->offset;
+    if (entry->is_double) {
+        *(double*)field = number;
+    } else {
+        *(int*)field = (int)number;
+    }
+    pthread_mutex_unlock(&g_configLock);
+    return 0;
+}
+
+// Helper: trim leading/trailing whitespace in place
+static char* trim(char* text)
+{
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    char* end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return text;
+}
+
+/**
+ * config_load()
+ * Reads "key = value" lines. Blank lines and '#' comments are skipped.
+ * Every good line is applied even if another line is bad.
+ */
+int config_load(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        perror("fopen for config file failed");
+        return -1;
+    }
+
+    int rc = 0;
+    int line_no = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        char* hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char* text = trim(line);
+        if (*text == '\0') {
+            continue;
+        }
+
+        char* eq = strchr(text, '=');
+        if (!eq) {
+            fprintf(stderr, "config_load: %s:%d: expected 'key = value'\n", path, line_no);
+            rc = -1;
+            continue;
+        }
+        *eq = '\0';
+        if (config_set(trim(text), trim(eq + 1)) == -1) {
+            fprintf(stderr, "config_load: %s:%d: setting ignored\n", path, line_no);
+            rc = -1;
+        }
+    }
+
+    fclose(fp);
+    return rc;
+}
+
+/**
+ * config_mq_msg_max()
+ * The kernel's limit on mq_maxmsg for unprivileged processes, or -1 if it can't be read.
+ */
+long config_mq_msg_max(void)
+{
+    FILE* fp = fopen(MQ_MSG_MAX_PATH, "r");
+    if (!fp) {
+        return -1;
+    }
+    long limit = -1;
+    if (fscanf(fp, "%ld", &limit) != 1) {
+        limit = -1;
+    }
+    fclose(fp);
+    return limit;
+}
+
+/**
+ * print_config()
+ * Lists every setting (served by a bare CONFIG command).
+ */
+void print_config(void)
+{
+    ServerConfig cfg = config_snapshot();
+
+    printf("===== Server Config =====\n");
+    for (size_t i = 0; i < NUM_CONFIG_KEYS; i++) {
+        char* field = (char*)&cfg + g_configKeys[i].offset;
+        if (g_configKeys[i].is_double) {
+            printf(" -> %s = %g\n", g_configKeys[i].key, *(double*)field);
+        } else {
+            printf(" -> %s = %d\n", g_configKeys[i].key, *(int*)field);
+        }
+    }
+    printf("=========================\n");
+}
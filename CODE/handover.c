@@ -0,0 +1,246 @@
+// handover.c
+//
+// Zero-downtime replacement of a running server ("./server --takeover").
+// /server_queue is a kernel object, so it outlives the old server: while the old
+// server finishes its running commands, clients keep sending into it and nothing
+// is lost. What does live only in the old process (settings, the client registry,
+// the scheduler lanes and commands queued there) is sent across on a second
+// queue, HANDOVER_QUEUE_NAME. See prototype_defs.h for the record format.
+
+#include "prototype_defs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+
+// Helper: send one control record (client_pid 0) on the handover queue, never blocking for long
+static int send_record(MyMessageQueue* queue, const char* text)
+{
+    MyMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.client_pid = 0;
+    snprintf(msg.content, sizeof(msg.content), "%s", text);
+    return enqueue_message_timed(queue, &msg, HANDOVER_PEER_TIMEOUT_MS);
+}
+
+// Helper: open the new server's handover queue, only if that server is still alive and
+// the queue is still there. Opened afresh every time, so once the new server gives up
+// (and unlinks it) we notice instead of filling a queue nobody reads.
+static MyMessageQueue* open_peer(long new_server_pid)
+{
+    if (new_server_pid <= 0 || kill((pid_t)new_server_pid, 0) != 0) {
+        return NULL;
+    }
+    return open_existing_queue(HANDOVER_QUEUE_NAME);
+}
+
+/**
+ * handover_accept()
+ * Old server side, straight from the ingestion loop. Anyone can put "HANDOVER <pid>" on
+ * /server_queue (or replay it), so we only stop for a live process that really is waiting.
+ */
+int handover_accept(long new_server_pid)
+{
+    MyMessageQueue* queue = open_peer(new_server_pid);
+    if (!queue) {
+        fprintf(stderr, "handover_accept: server %ld is not waiting for a handover, ignoring it\n",
+                new_server_pid);
+        return -1;
+    }
+
+    char text[64];
+    snprintf(text, sizeof(text), "ACK %ld", (long)getpid());
+    int rc = send_record(queue, text);
+    destroy_message_queue(queue, 0);
+    return rc;
+}
+
+/**
+ * handover_heartbeat()
+ * Old server side, while running commands (maybe a long BATCH) finish before the state goes out.
+ */
+int handover_heartbeat(long new_server_pid)
+{
+    MyMessageQueue* queue = open_peer(new_server_pid);
+    if (!queue) {
+        return -1;
+    }
+    int rc = send_record(queue, "WAIT");
+    destroy_message_queue(queue, 0);
+    return rc;
+}
+
+int handover_in_progress(void)
+{
+    MyMessageQueue* queue = open_existing_queue(HANDOVER_QUEUE_NAME);
+    if (!queue) {
+        return 0;
+    }
+    destroy_message_queue(queue, 0);
+    return 1;
+}
+
+/**
+ * handover_send_state()
+ * Old server side. The workers are already stopped, so the registry and lanes
+ * won't change under us and whatever is still queued was never started.
+ * A command is only taken out of the scheduler once it is on the queue, so if the
+ * new server goes away halfway the rest can still be run here.
+ */
+int handover_send_state(long new_server_pid)
+{
+    MyMessageQueue* queue = open_peer(new_server_pid);
+    if (!queue) {
+        fprintf(stderr, "handover_send_state: server %ld is gone or no longer waiting\n", new_server_pid);
+        return -1;
+    }
+
+    char text[MAX_MSG_CONTENT];
+    int ok = 1;
+
+    // 1) Live settings, so CONFIG changes survive the restart
+    ServerConfig cfg = config_snapshot();
+    snprintf(text, sizeof(text),
+             "CONFIG worker_count=%d queue_depth=%d lane_depth=%d shell_timeout_ms=%d poll_interval_ms=%d "
+             "max_clients=%d default_weight=%d default_max_inflight=%d default_rate=%g drain_timeout_ms=%d",
+             cfg.worker_count, cfg.queue_depth, cfg.lane_depth, cfg.shell_timeout_ms, cfg.poll_interval_ms,
+             cfg.max_clients, cfg.default_weight, cfg.default_max_inflight, cfg.default_rate,
+             cfg.drain_timeout_ms);
+    ok = send_record(queue, text) == 0;
+
+    // 2) Registry (who is registered, who is hidden)
+    RegisteredClient clients[MAX_CLIENTS];
+    int numClients = get_registered_clients(clients, MAX_CLIENTS);
+    for (int i = 0; ok && i < numClients; i++) {
+        snprintf(text, sizeof(text), "CLIENT %ld %d", clients[i].pid, clients[i].hidden);
+        ok = send_record(queue, text) == 0;
+    }
+
+    // 3) Scheduler lanes (weights and limits)
+    for (int i = 0; ok && i < MAX_CLIENTS; i++) {
+        long pid;
+        int weight, max_inflight;
+        double rate;
+        if (scheduler_export_lane(i, &pid, &weight, &max_inflight, &rate)) {
+            snprintf(text, sizeof(text), "LANE %ld %d %d %g", pid, weight, max_inflight, rate);
+            ok = send_record(queue, text) == 0;
+        }
+    }
+
+    // 4) Commands that were queued but not started, in per-client order
+    int pending = 0;
+    MyMessage msg;
+    while (ok && scheduler_take_pending(&msg) == 0) {
+        if (enqueue_message_timed(queue, &msg, HANDOVER_PEER_TIMEOUT_MS) == -1) {
+            scheduler_putback_pending(&msg);
+            ok = 0;
+            break;
+        }
+        pending++;
+    }
+
+    if (ok) {
+        ok = send_record(queue, "END") == 0;
+    }
+    destroy_message_queue(queue, 0); // the new server unlinks it
+
+    if (!ok) {
+        fprintf(stderr, "handover_send_state: server %ld stopped listening after %d queued commands\n",
+                new_server_pid, pending);
+        return -1;
+    }
+    printf("[handover]: Sent %d clients and %d queued commands to server %ld.\n",
+           numClients, pending, new_server_pid);
+    return 0;
+}
+
+// Helper: apply one record received from the old server
+static void apply_record(MyMessage* msg)
+{
+    if (msg->client_pid != 0) {
+        scheduler_submit(msg);  // an unstarted command, keeps its correlation ID
+        return;
+    }
+
+    long pid;
+    int hidden, weight, max_inflight;
+    double rate;
+
+    if (strncmp(msg->content, "CONFIG ", 7) == 0) {
+        char* save = NULL;
+        for (char* pair = strtok_r(msg->content + 7, " ", &save); pair; pair = strtok_r(NULL, " ", &save)) {
+            char* eq = strchr(pair, '=');
+            if (eq) {
+                *eq = '\0';
+                config_set(pair, eq + 1);
+            }
+        }
+    } else if (sscanf(msg->content, "CLIENT %ld %d", &pid, &hidden) == 2) {
+        set_client_status((pid_t)pid, hidden);
+    } else if (sscanf(msg->content, "LANE %ld %d %d %lf", &pid, &weight, &max_inflight, &rate) == 4) {
+        scheduler_set_weight(pid, weight);
+        scheduler_set_limits(pid, max_inflight, rate);
+    } else {
+        fprintf(stderr, "handover: ignoring unknown record '%s'\n", msg->content);
+    }
+}
+
+/**
+ * handover_request()
+ * New server side, called before the workers and the ingestion loop start.
+ * The old server answers with an ACK as soon as it reads our request and then sends
+ * WAIT heartbeats while its running commands finish, so we only give up after
+ * HANDOVER_PEER_TIMEOUT_MS of silence, however long those commands take.
+ */
+int handover_request(MyMessageQueue* serverQueue)
+{
+    // Start from an empty queue, a crashed earlier takeover may have left records behind
+    mq_unlink(HANDOVER_QUEUE_NAME);
+
+    MyMessageQueue* queue = create_custom_queue(HANDOVER_QUEUE_NAME, DEFAULT_QUEUE_DEPTH);
+    if (!queue) {
+        fprintf(stderr, "handover_request: cannot create %s\n", HANDOVER_QUEUE_NAME);
+        return -1;
+    }
+
+    // Ask whoever is reading /server_queue to hand over to us
+    MyMessage request;
+    memset(&request, 0, sizeof(request));
+    request.client_pid = getpid();
+    snprintf(request.content, sizeof(request.content), "HANDOVER %ld", (long)getpid());
+    if (enqueue_message(serverQueue, &request) == -1) {
+        destroy_message_queue(queue, 1);
+        return -1;
+    }
+
+    long old_pid = 0;
+    int records = 0;
+    int complete = 0;
+
+    MyMessage msg;
+    while (dequeue_message_timed(queue, &msg, HANDOVER_PEER_TIMEOUT_MS) == 0) {
+        if (msg.client_pid == 0 && strcmp(msg.content, "END") == 0) {
+            complete = 1;
+            break;
+        }
+        if (msg.client_pid == 0 && sscanf(msg.content, "ACK %ld", &old_pid) == 1) {
+            printf("[handover]: Server %ld accepted, waiting for its running commands...\n", old_pid);
+            continue;
+        }
+        if (msg.client_pid == 0 && strcmp(msg.content, "WAIT") == 0) {
+            continue;
+        }
+        apply_record(&msg);
+        records++;
+    }
+
+    if (!complete) {
+        fprintf(stderr, "handover_request: %s within %d ms (got %d records), starting anyway\n",
+                old_pid ? "previous server went quiet" : "no answer", HANDOVER_PEER_TIMEOUT_MS, records);
+    }
+
+    destroy_message_queue(queue, 1);
+    return complete ? records : -1;
+}
@@ -13,6 +13,7 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <time.h>
+#include <stdint.h>    // intptr_t for the child thread's exit value
 
 /* 
    A simple global or static array to store known clients.
@@ -21,20 +22,35 @@
 */
 static RegisteredClient g_registeredClients[MAX_CLIENTS];
 static int g_numClients = 0;
+// Commands now run on several worker threads at once, so the array needs a lock
+static pthread_mutex_t g_registryLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+   Slab pools for the objects the command path used to malloc/free every time.
+   They are filled lazily on first use, after that it's just free-list pops/pushes.
+   Each worker gets its own ThreadArg/pthread_t pools (index = worker index): only that
+   worker and the child thread it joins ever touch them, so their locks are never contended.
+   The shared pair serves the main thread and the client.
+   Messages need no pool: they live on the stack or inline in the scheduler lanes, and the
+   server has no reply channel (results are printed), so there are no reply buffers either.
+*/
+static MyObjectPool g_threadArgPool = OBJECT_POOL_INITIALIZER("ThreadArg", ThreadArg, THREAD_ARG_POOL_SIZE);
+static MyObjectPool g_threadIdPool  = OBJECT_POOL_INITIALIZER("pthread_t", pthread_t, THREAD_ID_POOL_SIZE);
+static MyObjectPool g_queuePool     = OBJECT_POOL_INITIALIZER("MyMessageQueue", MyMessageQueue, QUEUE_POOL_SIZE);
+
+static MyObjectPool g_workerArgPools[SCHED_MAX_WORKERS];
+static MyObjectPool g_workerIdPools[SCHED_MAX_WORKERS];
+static char g_workerPoolNames[SCHED_MAX_WORKERS][2][24];
+static pthread_once_t g_workerPoolsOnce = PTHREAD_ONCE_INIT;
+static __thread int t_poolIndex = -1;  // -1 = shared pools
 
 /**
  * search the array for a matching pid. If found, return a pointer to that element; otherwise return NULL
  * We do not allocate new memory for the returned pointer. 
  * We just return the address within the static array. The caller must not free it.
  */
-RegisteredClient* get_client_status(pid_t client_ID)
+static RegisteredClient* find_client_locked(pid_t client_ID)
 {
-    // Edge case: if client_ID == 0, bail out
-    if (client_ID == 0) {
-        fprintf(stderr, "get_client_status: Invalid client_ID == 0\n");
-        return NULL;
-    }
-
     // Look through our array for a matching PID
     for (int i = 0; i < g_numClients; i++) {
         if (g_registeredClients[i].pid == client_ID) {
@@ -46,6 +62,20 @@ RegisteredClient* get_client_status(pid_t client_ID)
     return NULL;
 }
 
+RegisteredClient* get_client_status(pid_t client_ID)
+{
+    // Edge case: if client_ID == 0, bail out
+    if (client_ID == 0) {
+        fprintf(stderr, "get_client_status: Invalid client_ID == 0\n");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_registryLock);
+    RegisteredClient* rc = find_client_locked(client_ID);
+    pthread_mutex_unlock(&g_registryLock);
+    return rc;
+}
+
 /*
 * Check if status is valid (0 or 1).
 * Try finding the client with get_client_status().
@@ -60,18 +90,28 @@ RegisteredClient* set_client_status(pid_t client_ID, int status)
         return NULL;
     }
 
+    if (client_ID == 0) {
+        fprintf(stderr, "set_client_status: Invalid client_ID == 0\n");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_registryLock);
+
     // First, see if client already exists
-    RegisteredClient* rc = get_client_status(client_ID);
+    RegisteredClient* rc = find_client_locked(client_ID);
     if (rc) {
         // If exists, just update it
         rc->hidden = status;
+        pthread_mutex_unlock(&g_registryLock);
         return rc;
     }
 
-    // Otherwise, we need to add a new client entry
-    if (g_numClients >= MAX_CLIENTS) {
+    // Otherwise, we need to add a new client entry (max_clients can be lowered at runtime)
+    int max_clients = config_snapshot().max_clients;
+    if (g_numClients >= max_clients) {
+        pthread_mutex_unlock(&g_registryLock);
         fprintf(stderr, "set_client_status: Reached max clients (%d). Cannot add client %ld\n",
-                MAX_CLIENTS, (long)client_ID);
+                max_clients, (long)client_ID);
         return NULL;
     }
 
@@ -80,9 +120,12 @@ RegisteredClient* set_client_status(pid_t client_ID, int status)
     g_registeredClients[g_numClients].hidden = status;
 
     g_numClients++;
+    rc = &g_registeredClients[g_numClients - 1];
+
+    pthread_mutex_unlock(&g_registryLock);
 
     // Return pointer to the newly added entry
-    return &g_registeredClients[g_numClients - 1];
+    return rc;
 }
 
 /**
@@ -91,6 +134,8 @@ RegisteredClient* set_client_status(pid_t client_ID, int status)
  */
 int remove_client_status(pid_t client_ID) 
 {
+    pthread_mutex_lock(&g_registryLock);
+
     // find the index of the given client
     int idx = -1;
     for (int i = 0; i < g_numClients; i++) {
@@ -101,6 +146,7 @@ int remove_client_status(pid_t client_ID)
     }
     if (idx == -1) {
         // client not found
+        pthread_mutex_unlock(&g_registryLock);
         return -1;
     }
     // Shift subsequent entries down by 1
@@ -108,15 +154,29 @@ int remove_client_status(pid_t client_ID)
         g_registeredClients[j] = g_registeredClients[j + 1];
     }
     g_numClients--;
+    pthread_mutex_unlock(&g_registryLock);
     return 0;
 }
 
 
+/**
+ * Copy of the registry (for handing it over to a new server process).
+ */
+int get_registered_clients(RegisteredClient* out, int max)
+{
+    pthread_mutex_lock(&g_registryLock);
+    int n = g_numClients < max ? g_numClients : max;
+    memcpy(out, g_registeredClients, sizeof(RegisteredClient) * (size_t)n);
+    pthread_mutex_unlock(&g_registryLock);
+    return n;
+}
+
 // Helper function: This is a quick example of how to print visible clients
 // (hidden == 0).
 void list_visible_clients() 
 {
     int visibleCount = 0;
+    pthread_mutex_lock(&g_registryLock);
     printf("===== Visible Clients =====\n");
     for (int i = 0; i < g_numClients; i++) {
         if (g_registeredClients[i].hidden == 0) {
@@ -128,19 +188,188 @@ void list_visible_clients()
         printf("All Clients Are Hidden...\n");
     }
     printf("===========================\n");
+    pthread_mutex_unlock(&g_registryLock);
+}
+
+/**
+ * pool_alloc()
+ * Pops a slot off the pool's free-list. The slab itself is allocated (once) the
+ * first time we get here. If every slot is handed out we fall back to malloc so
+ * that a burst never fails a command, the fallback counter tells us to grow the pool.
+ */
+void* pool_alloc(MyObjectPool* pool)
+{
+    void* slot = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    // First use: carve the slab and thread every slot onto the free-list
+    if (!pool->slab) {
+        pool->slab = (unsigned char*)malloc(pool->slot_size * (size_t)pool->capacity);
+        if (pool->slab) {
+            for (int i = pool->capacity - 1; i >= 0; i--) {
+                void* s = pool->slab + (size_t)i * pool->slot_size;
+                *(void**)s = pool->free_list;
+                pool->free_list = s;
+            }
+        } else {
+            perror("malloc for pool slab failed");
+        }
+    }
+
+    if (pool->free_list) {
+        slot = pool->free_list;
+        pool->free_list = *(void**)slot;
+        pool->allocs++;
+        pool->in_use++;
+        if (pool->in_use > pool->high_water) {
+            pool->high_water = pool->in_use;
+        }
+    } else {
+        pool->fallback_allocs++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!slot) {
+        // Slab exhausted (or never created) -> plain heap allocation
+        slot = malloc(pool->slot_size);
+        if (!slot) {
+            perror("malloc for pool fallback failed");
+            return NULL;
+        }
+    }
+    memset(slot, 0, pool->slot_size);
+    return slot;
+}
+
+/**
+ * pool_free()
+ * Pushes a slot back onto the free-list, or free()s it if it came from the fallback.
+ */
+void pool_free(MyObjectPool* pool, void* ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    unsigned char* p = (unsigned char*)ptr;
+    int from_slab = pool->slab &&
+                    p >= pool->slab &&
+                    p <  pool->slab + pool->slot_size * (size_t)pool->capacity;
+
+    pthread_mutex_lock(&pool->lock);
+    if (from_slab) {
+        *(void**)ptr = pool->free_list;
+        pool->free_list = ptr;
+        pool->frees++;
+        pool->in_use--;
+    } else {
+        pool->fallback_frees++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!from_slab) {
+        free(ptr);
+    }
+}
+
+// Helper: set up every worker's pools (once per process)
+static void init_worker_pools(void)
+{
+    for (int i = 0; i < SCHED_MAX_WORKERS; i++) {
+        snprintf(g_workerPoolNames[i][0], sizeof(g_workerPoolNames[i][0]), "ThreadArg[w%d]", i);
+        snprintf(g_workerPoolNames[i][1], sizeof(g_workerPoolNames[i][1]), "pthread_t[w%d]", i);
+        MyObjectPool args = OBJECT_POOL_INITIALIZER(g_workerPoolNames[i][0], ThreadArg, WORKER_POOL_SIZE);
+        MyObjectPool ids  = OBJECT_POOL_INITIALIZER(g_workerPoolNames[i][1], pthread_t, WORKER_POOL_SIZE);
+        g_workerArgPools[i] = args;
+        g_workerIdPools[i]  = ids;
+    }
+}
+
+// Helper: ThreadArg pool for a pool index (-1 = shared)
+static MyObjectPool* arg_pool(int index)
+{
+    return index < 0 ? &g_threadArgPool : &g_workerArgPools[index];
+}
+
+// Helper: pthread_t pool of the calling thread
+static MyObjectPool* id_pool(void)
+{
+    return t_poolIndex < 0 ? &g_threadIdPool : &g_workerIdPools[t_poolIndex];
+}
+
+void pool_bind_worker(int worker_index)
+{
+    if (worker_index < 0 || worker_index >= SCHED_MAX_WORKERS) {
+        return;
+    }
+    pthread_once(&g_workerPoolsOnce, init_worker_pools);
+    t_poolIndex = worker_index;
+}
+
+ThreadArg* acquire_thread_arg(void)
+{
+    ThreadArg* tArg = (ThreadArg*)pool_alloc(arg_pool(t_poolIndex));
+    if (tArg) {
+        tArg->pool_index = t_poolIndex;  // freed by the child thread, which has no pools of its own
+    }
+    return tArg;
+}
+
+void release_thread_arg(ThreadArg* tArg)
+{
+    if (tArg) {
+        pool_free(arg_pool(tArg->pool_index), tArg);
+    }
+}
+
+void release_thread_handle(pthread_t* tid)
+{
+    pool_free(id_pool(), tid);
+}
+
+// Helper: one line of counters for a single pool
+static void print_one_pool(MyObjectPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    printf(" -> %-15s slots=%-3d in_use=%-3d high_water=%-3d allocs=%lu frees=%lu fallback_allocs=%lu fallback_frees=%lu\n",
+           pool->name, pool->capacity, pool->in_use, pool->high_water,
+           pool->allocs, pool->frees, pool->fallback_allocs, pool->fallback_frees);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * print_pool_stats()
+ * Dumps the allocator counters. In steady state fallback_allocs should stay flat,
+ * which means the command path is not calling malloc/free anymore.
+ */
+void print_pool_stats(void)
+{
+    printf("===== Allocator Stats =====\n");
+    print_one_pool(&g_threadArgPool);
+    print_one_pool(&g_threadIdPool);
+    print_one_pool(&g_queuePool);
+    pthread_once(&g_workerPoolsOnce, init_worker_pools);
+    for (int i = 0; i < SCHED_MAX_WORKERS; i++) {
+        if (g_workerArgPools[i].slab) {  // only workers that have run something
+            print_one_pool(&g_workerArgPools[i]);
+            print_one_pool(&g_workerIdPools[i]);
+        }
+    }
+    printf("===========================\n");
 }
 
 /**
  * Creates or opens a POSIX message queue and returns a pointer to MyMessageQueue.
  */
 MyMessageQueue* create_custom_queue(char* name, long max_messages) {
-    // Allocate our "queue object"
-    MyMessageQueue* myObj = (MyMessageQueue*)malloc(sizeof(MyMessageQueue));
+    // Grab our "queue object" from the queue pool (comes back zeroed)
+    MyMessageQueue* myObj = (MyMessageQueue*)pool_alloc(&g_queuePool);
     if (!myObj) {
-        perror("malloc for create_custom_queue failed");
+        perror("pool_alloc for create_custom_queue failed");
         return NULL;
     }
-    memset(myObj, 0, sizeof(MyMessageQueue));
 
     // Copy the queue name into the struct
     strncpy(myObj->queue_name, name, sizeof(myObj->queue_name) - 1);
@@ -161,8 +390,10 @@ MyMessageQueue* create_custom_queue(char* name, long max_messages) {
     // returns a message queue descriptor that points to the shared kernel queue.
     mqd_t mqd = mq_open(myObj->queue_name, O_CREAT | O_RDWR, 0644, &myObj->attributes);
     if (mqd == (mqd_t)-1) {
+        int saved_errno = errno; // callers look at it (EINVAL: max_messages above the system limit)
         perror("mq_open failed");
-        free(myObj);
+        pool_free(&g_queuePool, myObj);
+        errno = saved_errno;
         return NULL;
     }
 
@@ -189,7 +420,7 @@ void destroy_message_queue(MyMessageQueue* myObj, int unlink_on_destroy) {
         }
     }
 
-    free(myObj);
+    pool_free(&g_queuePool, myObj);
 }
 
 /**
@@ -201,6 +432,8 @@ int enqueue_message(MyMessageQueue* myObj, MyMessage* msg) {
         errno = EINVAL;
         return -1;
     }
+    msg->sent_us = trace_now_us(); // lets the server trace how long it sat in the queue
+
     // mq_send blocks if the queue is full (and mq_flags=0), or returns EAGAIN if non-blocking
     // client uses mq_send, can now store in the kernel’s queue  in our implementation its named "/server_queue"
     if (mq_send(myObj->msg_queue_descriptor, (char*)msg, sizeof(MyMessage), 0) == -1) {
@@ -235,84 +468,448 @@ int dequeue_message(MyMessageQueue* myObj, MyMessage* outMsg) {
     return 0;
 }
 
+// Set by shell_abort_running() when SHUTDOWN runs out of drain time
+static int g_abortRunning = 0;
+static int g_abortedCount = 0;
+
+void shell_abort_running(int on)
+{
+    __atomic_store_n(&g_abortRunning, on, __ATOMIC_RELAXED);
+}
+
+int shell_aborted_count(void)
+{
+    return __atomic_load_n(&g_abortedCount, __ATOMIC_RELAXED);
+}
+
+static int abort_requested(void)
+{
+    return __atomic_load_n(&g_abortRunning, __ATOMIC_RELAXED);
+}
+
+// Helper: monotonic microseconds for timeouts (trace_now_us() is wall clock and can step backwards)
+static unsigned long long monotonic_now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL + (unsigned long long)now.tv_nsec / 1000ULL;
+}
+
+// Helper: commands the server handles itself instead of forking a shell
+static int is_builtin_command(const char* command)
+{
+    return strcmp(command, "REGISTER") == 0 ||
+           strcmp(command, "LIST") == 0 ||
+           strcmp(command, "HIDE") == 0 ||
+           strcmp(command, "UNHIDE") == 0 ||
+           strcmp(command, "EXIT") == 0 ||
+           strcmp(command, "STATS") == 0 ||
+           strcmp(command, "exit") == 0;
+}
+
 /**
- * child_thread_func()
- * Thread function that logs its own ID.
+ * is_control_command()
+ * Server control messages (see server.c). They act on the whole server, not on one client,
+ * so they only work as messages of their own and never inside a BATCH.
  */
-void* child_thread_func(void* arg) {
-    printf("[Child Thread -- %lu]: Hello from the child_thread.\n",
-        (unsigned long)pthread_self());
-    // cast and retrieve data
-    ThreadArg* data = (ThreadArg*)arg;
-    if (!data) {
-        pthread_exit(NULL);
+int is_control_command(const char* command)
+{
+    static const char* keywords[] = { "SHUTDOWN", "HANDOVER", "CONFIG", "WEIGHT", "LIMIT", "SCHED", BATCH_KEYWORD };
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        size_t n = strlen(keywords[i]);
+        if (strncmp(command, keywords[i], n) == 0 && (command[n] == '\0' || command[n] == ' ')) {
+            return 1;
+        }
     }
-    // get the actual TID
-    pthread_t tid = pthread_self();
+    return 0;
+}
 
-    // now print with real TID
-    printf("[Child Thread * %lu]: Handling command '%s' for client PID=%ld\n",
-           (unsigned long)tid, data->command, data->client_pid);
+/**
+ * run_single_command()
+ * child-thread-specific logic (HIDE, UNHIDE, etc.), anything else is a shell command.
+ */
+int run_single_command(const char* command, long client_pid)
+{
+    pthread_t tid = pthread_self();
+    int rc = 0;
 
-    // In a real program you could do your actual child thread logic here (shell exec and user-defined commands)...
-    // child-thread-specific logic (HIDE, UNHIDE, etc.)
-    if (strcmp(data->command, "REGISTER") == 0) {
-        set_client_status(data->client_pid, 0);
+    if (strcmp(command, "REGISTER") == 0) {
+        rc = set_client_status(client_pid, 0) ? 0 : -1;
         printf("[Child Thread -- %lu]: Registered client %ld (visible=0)\n",
-               (unsigned long)tid, (long)data->client_pid);
+               (unsigned long)tid, client_pid);
     }
-    else if (strcmp(data->command, "LIST") == 0) {
+    else if (strcmp(command, "LIST") == 0) {
         // etc.
         list_visible_clients(); 
         printf("[Child Thread -- %lu]: Done listing.\n", (unsigned long)tid);
     }
-    else if (strcmp(data->command, "HIDE") == 0) {
-        set_client_status(data->client_pid, 1);
+    else if (strcmp(command, "HIDE") == 0) {
+        rc = set_client_status(client_pid, 1) ? 0 : -1;
         printf("[Child Thread -- %lu]: Client %ld is now hidden.\n",
-               (unsigned long)tid, (long)data->client_pid);
+               (unsigned long)tid, client_pid);
     }
-    else if (strcmp(data->command, "UNHIDE") == 0) {
-        set_client_status(data->client_pid, 0);
+    else if (strcmp(command, "UNHIDE") == 0) {
+        rc = set_client_status(client_pid, 0) ? 0 : -1;
         printf("[Child Thread -- %lu]: Client %ld is now visible.\n",
-               (unsigned long)tid, (long)data->client_pid);
+               (unsigned long)tid, client_pid);
     }
-    else if (strcmp(data->command, "EXIT") == 0) {
-        remove_client_status(data->client_pid);
+    else if (strcmp(command, "EXIT") == 0) {
+        rc = remove_client_status(client_pid);
         printf("[Child Thread -- %lu]: Cleaned up client %ld.\n",
-               (unsigned long)tid, (long)data->client_pid);
+               (unsigned long)tid, client_pid);
     }
-    else if (strcmp(data->command, "exit") == 0) {
+    else if (strcmp(command, "STATS") == 0) {
+        print_pool_stats();
+        printf("[Child Thread -- %lu]: Done printing allocator stats.\n", (unsigned long)tid);
+    }
+    else if (strcmp(command, "exit") == 0) {
         printf("[Child Thread -- %lu]: Ignoring lowercase 'exit'.\n",
                (unsigned long)tid);
     }
     else {
-        // Possibly a shell command => fork/exec with 3-sec timeout
+        // Possibly a shell command => fork/exec with timeout (shell_timeout_ms)
         printf("[Child Thread -- %lu]: Attempting shell command '%s'\n",
-               (unsigned long)tid, data->command);
-         shell_exec_with_timeout(data->command);
+               (unsigned long)tid, command);
+        rc = shell_exec_with_timeout((char*)command);
     }
+    return rc;
+}
 
-    free(data);  // free the ThreadArg
-    pthread_exit(NULL);
+int is_batch_message(const char* content)
+{
+    size_t n = strlen(BATCH_KEYWORD);
+    return strncmp(content, BATCH_KEYWORD, n) == 0 &&
+           (content[n] == '\0' || content[n] == ' ' || content[n] == '\n');
+}
+
+int count_batch_commands(const char* content)
+{
+    if (!is_batch_message(content)) {
+        return 1;
+    }
+    int count = 0;
+    const char* line = strchr(content, '\n');
+    while (line && count < BATCH_MAX_COMMANDS) {
+        line++;
+        if (*line != '\0' && *line != '\n') {
+            count++;
+        }
+        line = strchr(line, '\n');
+    }
+    return count > 0 ? count : 1;
+}
+
+// Helper: human readable outcome of one batch entry
+static const char* describe_result(int rc, char* buf, size_t len)
+{
+    if (rc == 0)                    snprintf(buf, len, "ok");
+    else if (rc == SHELL_TIMED_OUT) snprintf(buf, len, "timed out");
+    else if (rc == SHELL_FAILED)    snprintf(buf, len, "failed");
+    else if (rc == BATCH_REJECTED)  snprintf(buf, len, "rejected (control commands can't be batched)");
+    else if (rc == SHELL_ABORTED)   snprintf(buf, len, "aborted (drain deadline passed)");
+    else                            snprintf(buf, len, "exit %d", rc);
+    return buf;
+}
+
+/**
+ * run_batch()
+ * Splits "BATCH [-e] [-p]\n<cmd>\n<cmd>..." into its command lines and runs them in order.
+ * With -p, a run of consecutive shell commands is forked all at once and then reaped,
+ * built-ins always run one by one in their place. With -e we stop after the first
+ * step that failed (for a parallel run: after the run). The batch is edited in place.
+ * Control commands (is_control_command()) are not run and count as failed.
+ * After shell_abort_running() the commands not started yet are reported as aborted.
+ * *ran_exit is set to 1 if the batch ran EXIT, so the caller can release the client's lane.
+ */
+int run_batch(char* batch, long client_pid, int* ran_exit)
+{
+    pthread_t tid = pthread_self();
+    char* cmds[BATCH_MAX_COMMANDS];
+    int results[BATCH_MAX_COMMANDS];
+    int ran[BATCH_MAX_COMMANDS];
+    int count = 0;
+
+    // First line holds the flags
+    char* save = NULL;
+    char* header = strtok_r(batch, "\n", &save);
+    int stop_on_error = header && strstr(header, " -e") != NULL;
+    int parallel      = header && strstr(header, " -p") != NULL;
+
+    char* line;
+    while ((line = strtok_r(NULL, "\n", &save)) != NULL) {
+        if (count == BATCH_MAX_COMMANDS) {
+            fprintf(stderr, "run_batch: more than %d commands, ignoring the rest\n", BATCH_MAX_COMMANDS);
+            break;
+        }
+        if (is_control_command(line)) {
+            fprintf(stderr, "run_batch: '%s' is a control command, send it on its own\n", line);
+        }
+        cmds[count] = line;
+        results[count] = 0;
+        ran[count] = 0;
+        count++;
+    }
+
+    printf("[Child Thread -- %lu]: Running batch of %d commands for client %ld (stop-on-error=%d, parallel=%d)\n",
+           (unsigned long)tid, count, client_pid, stop_on_error, parallel);
+
+    int failed = 0;
+    int i = 0;
+    *ran_exit = 0;
+    while (i < count) {
+        if (abort_requested()) {
+            for (; i < count; i++) {
+                results[i] = SHELL_ABORTED;
+                ran[i] = 1;
+                failed++;
+                __atomic_add_fetch(&g_abortedCount, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+        if (is_control_command(cmds[i])) {
+            results[i] = BATCH_REJECTED;
+            ran[i] = 1;
+            failed++;
+            i++;
+        } else if (parallel && !is_builtin_command(cmds[i])) {
+            // Fork the whole run of shell commands, then reap them
+            pid_t pids[BATCH_MAX_COMMANDS];
+            unsigned long long starts[BATCH_MAX_COMMANDS];
+            int end = i;
+            while (end < count && !is_builtin_command(cmds[end]) && !is_control_command(cmds[end])) {
+                printf("[Child Thread -- %lu]: Starting shell command '%s' (parallel)\n",
+                       (unsigned long)tid, cmds[end]);
+                starts[end] = monotonic_now_us();
+                pids[end] = shell_spawn(cmds[end]);
+                end++;
+            }
+            for (int j = i; j < end; j++) {
+                results[j] = pids[j] < 0 ? SHELL_FAILED
+                                         : shell_wait_with_timeout(pids[j], cmds[j], starts[j]);
+                ran[j] = 1;
+                if (results[j] != 0) {
+                    failed++;
+                }
+            }
+            i = end;
+        } else {
+            results[i] = run_single_command(cmds[i], client_pid);
+            ran[i] = 1;
+            if (strcmp(cmds[i], "EXIT") == 0) {
+                *ran_exit = 1;
+            }
+            if (results[i] != 0) {
+                failed++;
+            }
+            i++;
+        }
+
+        if (stop_on_error && failed > 0) {
+            break;
+        }
+    }
+
+    // One combined reply for the whole batch
+    unsigned long long reply_start = trace_now_us();
+    char what[64];
+    printf("===== Batch Result (Client PID: %ld) =====\n", client_pid);
+    for (int k = 0; k < count; k++) {
+        printf(" -> [%d] '%s': %s\n", k + 1, cmds[k],
+               ran[k] ? describe_result(results[k], what, sizeof(what)) : "skipped");
+    }
+    printf(" -> %d of %d commands failed\n", failed, count);
+    printf("==========================================\n");
+    trace_span("reply", "server", reply_start, trace_now_us());
+
+    return failed;
+}
+
+/**
+ * dequeue_message_timed()
+ * mq_timedreceive() with a relative timeout, used while draining and during handover.
+ */
+int dequeue_message_timed(MyMessageQueue* myObj, MyMessage* outMsg, int timeout_ms) {
+    if (!myObj || !outMsg) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    ssize_t bytesRead = mq_timedreceive(myObj->msg_queue_descriptor,
+                                        (char*)outMsg,
+                                        sizeof(MyMessage),
+                                        NULL,
+                                        &deadline);
+    if (bytesRead < 0) {
+        if (errno != ETIMEDOUT) {
+            perror("mq_timedreceive failed");
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * enqueue_message_timed()
+ * mq_timedsend() with a relative timeout, so the handover never blocks on a queue nobody reads.
+ */
+int enqueue_message_timed(MyMessageQueue* myObj, MyMessage* msg, int timeout_ms) {
+    if (!myObj || !msg) {
+        errno = EINVAL;
+        return -1;
+    }
+    msg->sent_us = trace_now_us();
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    if (mq_timedsend(myObj->msg_queue_descriptor, (char*)msg, sizeof(MyMessage), 0, &deadline) == -1) {
+        if (errno != ETIMEDOUT) {
+            perror("mq_timedsend failed");
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * open_existing_queue()
+ * Like create_custom_queue() but without O_CREAT: only opens a queue that is already there.
+ */
+MyMessageQueue* open_existing_queue(char* name) {
+    MyMessageQueue* myObj = (MyMessageQueue*)pool_alloc(&g_queuePool);
+    if (!myObj) {
+        perror("pool_alloc for open_existing_queue failed");
+        return NULL;
+    }
+    strncpy(myObj->queue_name, name, sizeof(myObj->queue_name) - 1);
+
+    mqd_t mqd = mq_open(myObj->queue_name, O_RDWR);
+    if (mqd == (mqd_t)-1) {
+        int saved_errno = errno;
+        if (saved_errno != ENOENT) {
+            perror("mq_open (existing) failed");
+        }
+        pool_free(&g_queuePool, myObj);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    myObj->msg_queue_descriptor = mqd;
+    mq_getattr(mqd, &myObj->attributes);
+    return myObj;
+}
+
+/**
+ * create_private_queue()
+ * Like create_custom_queue(), but owner-only (0600) and always a new queue (O_EXCL), so
+ * nobody else can have created it beforehand with looser permissions.
+ */
+MyMessageQueue* create_private_queue(char* name, long max_messages) {
+    MyMessageQueue* myObj = (MyMessageQueue*)pool_alloc(&g_queuePool);
+    if (!myObj) {
+        perror("pool_alloc for create_private_queue failed");
+        return NULL;
+    }
+    strncpy(myObj->queue_name, name, sizeof(myObj->queue_name) - 1);
+
+    myObj->attributes.mq_flags   = 0;
+    myObj->attributes.mq_maxmsg  = max_messages;
+    myObj->attributes.mq_msgsize = sizeof(MyMessage);
+    myObj->attributes.mq_curmsgs = 0;
+
+    mq_unlink(myObj->queue_name);  // left over from a crashed server (or planted by someone else)
+    mqd_t mqd = mq_open(myObj->queue_name, O_CREAT | O_EXCL | O_RDWR, 0600, &myObj->attributes);
+    if (mqd == (mqd_t)-1) {
+        int saved_errno = errno;
+        perror("mq_open (private) failed");
+        pool_free(&g_queuePool, myObj);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    myObj->msg_queue_descriptor = mqd;
+    return myObj;
+}
+
+/**
+ * child_thread_func()
+ * Thread function that logs its own ID.
+ */
+void* child_thread_func(void* arg) {
+    printf("[Child Thread -- %lu]: Hello from the child_thread.\n",
+        (unsigned long)pthread_self());
+    // cast and retrieve data
+    ThreadArg* data = (ThreadArg*)arg;
+    if (!data) {
+        pthread_exit(NULL);
+    }
+    // get the actual TID
+    pthread_t tid = pthread_self();
+
+    // pick up the command's correlation ID so every span below is linked to it
+    unsigned long long started = trace_now_us();
+    trace_set_correlation(data->corr_id);
+    trace_thread_name("child thread");
+    trace_flow('f', started);
+
+    // now print with real TID
+    printf("[Child Thread * %lu]: Handling command '%s' for client PID=%ld\n",
+           (unsigned long)tid, data->command, data->client_pid);
+
+    // In a real program you could do your actual child thread logic here (shell exec and user-defined commands)...
+    int client_exited = 0;
+    if (is_batch_message(data->command)) {
+        run_batch(data->command, data->client_pid, &client_exited);
+    } else {
+        int rc = run_single_command(data->command, data->client_pid);
+        client_exited = strcmp(data->command, "EXIT") == 0;
+
+        // The reply: one result line, like the combined result of a BATCH
+        unsigned long long reply_start = trace_now_us();
+        char what[64];
+        printf("[Child Thread -- %lu]: Result for client %ld, '%s': %s\n",
+               (unsigned long)tid, data->client_pid, data->command, describe_result(rc, what, sizeof(what)));
+        trace_span("reply", "server", reply_start, trace_now_us());
+    }
+    trace_span("command", "server", started, trace_now_us());
+
+    release_thread_arg(data);  // hand the ThreadArg back to its pool
+    pthread_exit((void*)(intptr_t)client_exited);  // the worker frees the client's lane after EXIT
 }
 
 
 /**
  * spawn_thread_from_pool()
  * Creates a new thread that runs any function.
- * Returns a pointer to a newly allocated pthread_t.
+ * Returns a pointer to a pthread_t taken from the handle pool,
+ * give it back with release_thread_handle() once joined.
  */
 pthread_t* spawn_thread_from_pool(void* notification) {
-    pthread_t* new_tid = (pthread_t*)malloc(sizeof(pthread_t));
+    pthread_t* new_tid = (pthread_t*)pool_alloc(id_pool());
     if (!new_tid) {
-        perror("malloc for new thread failed");
+        perror("pool_alloc for new thread failed");
         return NULL;
     }
 
     int ret = pthread_create(new_tid, NULL, child_thread_func, notification); //  pass the notification pointer to child_thread_func()
     if (ret != 0) {
         perror("pthread_create failed");
-        free(new_tid);
+        pool_free(id_pool(), new_tid);
         return NULL;
     }
 
@@ -346,7 +943,7 @@ void create_client(pid_t parent_pid, pthread_t main_thread) {
     // In a real-world scenario, store child_tid somewhere or join it later
     // For demo, let's just join here
     pthread_join(*child_tid, NULL);
-    free(child_tid);
+    release_thread_handle(child_tid);
 
     printf("[Main Thread -- %lu]: create_client() completed. (Real parent was PID: %d)\n",
            (unsigned long)pthread_self(), real_parent);
@@ -375,22 +972,23 @@ void create_server(pid_t parent_pid, pthread_t main_thread) {
 
     // Join (or detach) the child thread
     pthread_join(*child_tid, NULL);
-    free(child_tid);
+    release_thread_handle(child_tid);
 
     printf("[Main Thread -- %lu]: create_server() completed. (Real parent was PID: %d)\n",
            (unsigned long)pthread_self(), real_parent);
 }
 
 /**
- * shell_exec_with_timeout()
- * function to fork/exec a shell command, with a 3-second limit.
+ * shell_spawn()
+ * fork/exec a shell command without waiting for it. Returns the child's pid, or -1.
  */
-void shell_exec_with_timeout(char *cmd)
+pid_t shell_spawn(char *cmd)
 {
+    unsigned long long fork_start = trace_now_us();
     pid_t pid = fork();
     if (pid < 0) {
         perror("fork");
-        return;
+        return -1;
     }
     else if (pid == 0) {
         // Child process: exec the command in /bin/bash
@@ -399,32 +997,78 @@ void shell_exec_with_timeout(char *cmd)
         perror("execlp");
         exit(EXIT_FAILURE);
     }
-    else {
-        // Parent process: wait up to 3 seconds, kill if it’s still running
-        time_t start = time(NULL);
-        int status;
-        while (1) {
-            pid_t result = waitpid(pid, &status, WNOHANG);
-            if (result == -1) {
-                perror("waitpid");
-                return;
-            }
-            else if (result == 0) {
-                // child still running
-                if (difftime(time(NULL), start) > 3.0) {
-                    // Timeout -> kill child
-                    kill(pid, SIGKILL);
-                    printf("[shell_exec_with_timeout]: Command '%s' timed out and was killed.\n", cmd);
-                    break;
-                }
-                // Sleep a bit before checking again
-                usleep(100000); // 100ms
+    trace_span("fork", "server", fork_start, trace_now_us());
+    return pid;
+}
+
+/**
+ * shell_wait_with_timeout()
+ * Parent side: wait until shell_timeout_ms after 'spawned_mono_us' (monotonic), kill the child if it's
+ * still running (or sooner, once shell_abort_running() was called). Both the timeout and the poll interval are read once per command, so CONFIG changes
+ * apply to the next one.
+ * For tracing, the child's lifetime shows up as an "exec" span on the child's own pid.
+ */
+int shell_wait_with_timeout(pid_t pid, char *cmd, unsigned long long spawned_mono_us)
+{
+    unsigned long long wait_start = trace_now_us();
+    ServerConfig cfg = config_snapshot();
+    unsigned long long timeout_us = (unsigned long long)cfg.shell_timeout_ms * 1000ULL;
+    int status;
+    int rc;
+    while (1) {
+        pid_t result = waitpid(pid, &status, WNOHANG);
+        if (result == -1) {
+            perror("waitpid");
+            rc = SHELL_FAILED;
+            break;
+        }
+        else if (result == 0) {
+            // child still running
+            if (monotonic_now_us() - spawned_mono_us > timeout_us) {
+                // Timeout -> kill child (and reap it so it doesn't linger as a zombie)
+                kill(pid, SIGKILL);
+                waitpid(pid, &status, 0);
+                printf("[shell_exec_with_timeout]: Command '%s' timed out and was killed.\n", cmd);
+                rc = SHELL_TIMED_OUT;
+                break;
             }
-            else {
-                // Child finished normally
-                printf("[shell_exec_with_timeout]: Command '%s' completed.\n", cmd);
+            if (abort_requested()) {
+                kill(pid, SIGKILL);
+                waitpid(pid, &status, 0);
+                printf("[shell_exec_with_timeout]: Command '%s' aborted, the drain deadline passed.\n", cmd);
+                __atomic_add_fetch(&g_abortedCount, 1, __ATOMIC_RELAXED);
+                rc = SHELL_ABORTED;
                 break;
             }
+            // Sleep a bit before checking again
+            usleep((useconds_t)cfg.poll_interval_ms * 1000); // 100ms by default
+        }
+        else {
+            // Child finished normally
+            printf("[shell_exec_with_timeout]: Command '%s' completed.\n", cmd);
+            rc = WIFEXITED(status) ? WEXITSTATUS(status) : SHELL_FAILED;
+            break;
         }
     }
+
+    // The span wants wall clock: count back from now by the monotonic lifetime
+    unsigned long long reaped = trace_now_us();
+    unsigned long long lifetime = monotonic_now_us() - spawned_mono_us;
+    trace_span_on("exec", "child", (long)pid, (long)pid, reaped > lifetime ? reaped - lifetime : 0, reaped);
+    trace_span("wait", "server", wait_start, reaped);
+    return rc;
+}
+
+/**
+ * shell_exec_with_timeout()
+ * function to fork/exec a shell command, with a time limit (3 seconds unless configured).
+ */
+int shell_exec_with_timeout(char *cmd)
+{
+    unsigned long long start = monotonic_now_us();
+    pid_t pid = shell_spawn(cmd);
+    if (pid < 0) {
+        return SHELL_FAILED;
+    }
+    return shell_wait_with_timeout(pid, cmd, start);
 }
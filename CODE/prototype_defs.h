@@ -6,15 +6,21 @@
 #include <mqueue.h>
 #include <sys/types.h>
 #include <pthread.h>  // for pthread_t
+#include <time.h>     // for time_t
+#include <stdio.h>    // for FILE
 
-#define MAX_CLIENTS 50 // arbitrary limit
+#define MAX_CLIENTS 50 // arbitrary limit (hard cap, the live limit is the max_clients setting)
+#define MAX_MSG_CONTENT 1024 // room for a BATCH of commands in one message
 
 /**
  * This struct holds a single message's content.
  */
 typedef struct {
     long client_pid;        // store which client sent the message
-    char content[256];      // the actual message text
+    unsigned long corr_id;  // correlation ID tying together the trace spans of one command
+    unsigned long long sent_us;     // wall clock (us) when enqueue_message() sent it
+    unsigned long long received_us; // wall clock (us) when the server took it off the queue
+    char content[MAX_MSG_CONTENT]; // the actual message text
 } MyMessage;
 
 /**
@@ -39,10 +45,203 @@ typedef struct {
  * Pass the necessary information (command string, client PID) to get the child thread
 */
 typedef struct {
-    char command[256];
+    char command[MAX_MSG_CONTENT];
     long client_pid;
+    unsigned long corr_id;  // carried over from the MyMessage for tracing
+    int pool_index;         // pool set it came from, the child thread gives it back there
 } ThreadArg;
 
+/*
+ * BATCH message: "BATCH [-e] [-p]\n<cmd1>\n<cmd2>\n..."
+ *   -e  stop at the first command that fails
+ *   -p  run consecutive shell commands in parallel (built-ins stay in order)
+ * The server runs everything in one child thread and prints one combined result.
+ */
+#define BATCH_KEYWORD      "BATCH"
+#define BATCH_MAX_COMMANDS 64
+
+/*
+ * Results of shell_exec_with_timeout() / shell_wait_with_timeout() besides the exit code
+ */
+#define SHELL_FAILED    -1  // fork/exec/waitpid failed
+#define SHELL_TIMED_OUT -2  // killed after shell_timeout_ms (3 seconds by default)
+#define BATCH_REJECTED  -3  // control command inside a BATCH, not run
+#define SHELL_ABORTED   -4  // killed (or, in a BATCH, not started) after shell_abort_running()
+
+/**
+ * A fixed-capacity slab of equally sized slots handed out from a free-list.
+ * The slab is carved out of one allocation on first use, so once the server
+ * is warmed up the command path never calls malloc/free. If the slab runs dry
+ * we fall back to malloc (and count it) rather than fail the command.
+ */
+typedef struct {
+    const char* name;            // label used by print_pool_stats()
+    size_t slot_size;            // bytes per slot (>= sizeof(void*))
+    int capacity;                // number of slots in the slab
+    unsigned char* slab;         // capacity * slot_size bytes, NULL until first use
+    void* free_list;             // intrusive singly linked list of free slots
+    pthread_mutex_t lock;
+
+    // allocator counters (read them with print_pool_stats())
+    unsigned long allocs;        // slots handed out from the slab
+    unsigned long frees;         // slots returned to the slab
+    unsigned long fallback_allocs; // slab exhausted -> malloc
+    unsigned long fallback_frees;  // free() of a fallback allocation
+    int in_use;                  // slab slots currently handed out
+    int high_water;              // largest in_use seen so far
+} MyObjectPool;
+
+// Static initializer, e.g. MyObjectPool p = OBJECT_POOL_INITIALIZER("args", ThreadArg, 64);
+#define OBJECT_POOL_INITIALIZER(label, type, cap) \
+    { (label), (sizeof(type) < sizeof(void*) ? sizeof(void*) : sizeof(type)), (cap), \
+      NULL, NULL, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0 }
+
+#define THREAD_ARG_POOL_SIZE 64   // command contexts kept warm (shared pool)
+#define THREAD_ID_POOL_SIZE  64   // pthread_t handles kept warm (shared pool)
+#define WORKER_POOL_SIZE     4    // slots per worker: a worker has one command (one child thread) at a time
+#define QUEUE_POOL_SIZE      4    // MyMessageQueue objects per process
+
+/*
+ * Fair scheduler settings (server only, see scheduler.c).
+ * Each client gets its own lane; lanes are served with deficit round robin.
+ */
+#define SCHED_WORKER_COUNT         4   // executor threads pulling from the scheduler (default)
+#define SCHED_MAX_WORKERS          32  // hard cap for the worker_count setting
+#define SCHED_LANE_CAPACITY        16  // commands buffered per client before we drop (hard cap for lane_depth)
+#define SCHED_QUANTUM              1   // credit added to a lane per round, per unit of weight
+#define SCHED_DEFAULT_WEIGHT       1
+#define SCHED_DEFAULT_MAX_INFLIGHT 1   // 1 keeps each client's commands in order
+#define SCHED_DEFAULT_RATE         0.0 // commands/sec per client, 0 = unlimited
+#define SCHED_RETRY_MS             10  // re-check interval while lanes are rate/in-flight limited
+
+/**
+ * One client's lane in the fair scheduler. Messages are stored inline
+ * in a ring so queuing a command never allocates.
+ */
+typedef struct {
+    long pid;                    // 0 => lane is free
+    int weight;                  // share of capacity relative to other lanes
+    int deficit;                 // DRR credit, spent 1 per dispatched command
+    int max_inflight;            // commands of this client allowed to run at once
+    int in_flight;               // commands of this client running right now
+    double rate;                 // token bucket refill (commands/sec), 0 = unlimited
+    double tokens;               // current bucket level
+    struct timespec last_refill; // when tokens were last topped up
+    struct timespec last_active; // last submit/complete, the oldest idle lane is reclaimed first
+    MyMessage ring[SCHED_LANE_CAPACITY];
+    int head;                    // index of the oldest queued message
+    int count;                   // number of queued messages
+    unsigned long dispatched;    // counters for the SCHED command
+    unsigned long dropped;
+} ClientLane;
+
+/*
+ * Traffic capture file (capture.c): written by "server --record <file>", read by ./replay.
+ *   header:  "MQTR" | uint32 version | int64 wall clock start (ns)
+ *   record:  uint64 arrival offset (ns since start) | int64 client pid | uint16 length | content bytes
+ */
+#define CAPTURE_MAGIC   "MQTR"
+#define CAPTURE_VERSION 1
+#define CAPTURE_BUFFER_SIZE (1 << 20) // stdio buffer, records are only flushed when it fills up
+
+/**
+ * One record read back from a capture file.
+ */
+typedef struct {
+    unsigned long long offset_ns; // arrival time relative to the start of the recording
+    long client_pid;
+    char content[MAX_MSG_CONTENT];
+} CaptureRecord;
+
+/*
+ * Message counters the server publishes in shared memory (capture.c), so ./replay can tell
+ * when everything it sent was actually run or dropped, not just taken off /server_queue.
+ * Updated with atomic adds, read with atomic loads.
+ */
+#define COUNTERS_SHM_NAME "/server_counters"
+typedef struct {
+    unsigned long received;   // messages taken off /server_queue
+    unsigned long completed;  // commands a worker finished, or control commands handled right away
+    unsigned long dropped;    // never run: the client's lane was full or no lane was free
+} ServerCounters;
+
+#define COUNTER_INC(counters, field) \
+    do { if (counters) __atomic_fetch_add(&(counters)->field, 1UL, __ATOMIC_RELAXED); } while (0)
+#define COUNTER_GET(counters, field) __atomic_load_n(&(counters)->field, __ATOMIC_RELAXED)
+
+/*
+ * Chrome trace / Perfetto export (tracing.c), enabled with --trace <file> on server and client.
+ * Events are buffered in memory and appended to the file TRACE_BUFFER_EVENTS at a time.
+ * The file is a JSON array without the closing ']', which both viewers accept, so
+ * several processes can append to the same file.
+ */
+#define TRACE_BUFFER_EVENTS 1024
+
+typedef struct {
+    const char* name;           // static string, e.g. "fork"
+    const char* cat;            // static string, e.g. "server"
+    char phase;                 // Chrome trace phase: X (span), b/e (async wait), s/t/f (flow), M (thread name)
+    unsigned long long ts_us;   // start, wall clock microseconds
+    unsigned long long dur_us;  // only for 'X'
+    long pid;
+    long tid;                   // kernel thread ID (gettid), not the pthread_t
+    unsigned long corr_id;
+} TraceEvent;
+
+/*
+ * Server settings (config.c). Loaded from "--config <file>" at startup (key = value lines,
+ * '#' starts a comment) and changed live with "CONFIG key=value ...". The defaults are
+ * the values that used to be hard-coded.
+ */
+#define DEFAULT_QUEUE_DEPTH      10
+#define DEFAULT_SHELL_TIMEOUT_MS 3000
+#define DEFAULT_POLL_INTERVAL_MS 100
+#define DEFAULT_DRAIN_TIMEOUT_MS 5000
+#define MQ_MSG_MAX_PATH          "/proc/sys/fs/mqueue/msg_max" // queue_depth limit for non-root users
+
+typedef struct {
+    int worker_count;          // executor threads (1..SCHED_MAX_WORKERS), applied live
+    int queue_depth;           // mq_maxmsg of /server_queue, only used when the queue is created
+                               // (non-root: at most /proc/sys/fs/mqueue/msg_max, 10 by default)
+    int lane_depth;            // commands buffered per client (1..SCHED_LANE_CAPACITY)
+    int shell_timeout_ms;      // shell commands are killed after this long
+    int poll_interval_ms;      // how often a running shell command is checked on
+    int max_clients;           // registered clients / lanes allowed (1..MAX_CLIENTS)
+    int default_weight;        // settings for new scheduler lanes
+    int default_max_inflight;
+    double default_rate;
+    int drain_timeout_ms;      // how long SHUTDOWN waits for queued/running commands
+} ServerConfig;
+
+/*
+ * Handover (handover.c): "server --takeover" replaces a running server without downtime.
+ * The new server creates HANDOVER_QUEUE_NAME and sends "HANDOVER <its pid>" on /server_queue.
+ * The old server only accepts it if that process is alive and HANDOVER_QUEUE_NAME already exists.
+ * It answers right away, stops reading /server_queue (so new messages wait there for the new
+ * server), lets running commands finish, then sends its state on the handover queue:
+ *   client_pid 0, "ACK <old pid>"                               sent as soon as the request is accepted
+ *   client_pid 0, "WAIT"                                        every HANDOVER_HEARTBEAT_MS while commands run
+ *   client_pid 0, "CONFIG <key>=<value>"                        live settings
+ *   client_pid 0, "CLIENT <pid> <hidden>"                       registry entries
+ *   client_pid 0, "LANE <pid> <weight> <max_inflight> <rate>"   scheduler lane settings
+ *   client_pid != 0                                             a queued command nobody started yet
+ *   client_pid 0, "END"
+ * and exits without unlinking /server_queue.
+ * Either side gives up when it hears nothing (or can't send) for HANDOVER_PEER_TIMEOUT_MS; the
+ * old server then runs its queued commands itself, like a SHUTDOWN.
+ */
+#define HANDOVER_QUEUE_NAME      "/server_handover"
+#define HANDOVER_HEARTBEAT_MS    1000
+#define HANDOVER_PEER_TIMEOUT_MS 5000
+
+/*
+ * Settings changes (CONFIG key=value, WEIGHT, LIMIT) are only taken from ADMIN_QUEUE_NAME,
+ * never from /server_queue. The server creates it owner-only (0600), so only processes of the
+ * server's own user (or root) can send on it: "./client --admin".
+ */
+#define ADMIN_QUEUE_NAME         "/server_admin"
+#define ADMIN_QUEUE_DEPTH        4
+
 /* =========================
    Function Prototypes
    ========================= */
@@ -50,8 +249,85 @@ RegisteredClient* get_client_status(pid_t client_ID);
 RegisteredClient* set_client_status(pid_t client_ID, int status);
 int remove_client_status(pid_t client_ID);
 void list_visible_clients(void);
+
+/**
+ * Copies up to 'max' registry entries into 'out' and returns how many were copied.
+ */
+int get_registered_clients(RegisteredClient* out, int max);
 void* child_thread_func(void* arg);
 
+/**
+ * Runs one command (built-in or shell) for a client.
+ * Returns 0 on success, non-zero otherwise (shell exit code or SHELL_* value).
+ */
+int run_single_command(const char* command, long client_pid);
+
+/**
+ * Runs the commands of a BATCH message in order and prints one combined result.
+ * Returns the number of commands that failed; *ran_exit tells whether EXIT was among them.
+ */
+int run_batch(char* batch, long client_pid, int* ran_exit);
+
+/**
+ * Returns 1 for server control messages (SHUTDOWN, HANDOVER, CONFIG, WEIGHT, LIMIT, SCHED, BATCH),
+ * which are rejected inside a BATCH, 0 otherwise.
+ */
+int is_control_command(const char* command);
+
+/**
+ * Returns 1 for messages that start with the BATCH keyword, 0 otherwise.
+ */
+int is_batch_message(const char* content);
+
+/**
+ * Number of commands in a message: 1, or the number of command lines of a BATCH.
+ */
+int count_batch_commands(const char* content);
+
+/**
+ * fork/exec a shell command and wait for it, killing it after shell_timeout_ms.
+ * shell_spawn() only starts it (returns the child's pid or -1), shell_wait_with_timeout() reaps it,
+ * counting the timeout from 'spawned_mono_us' (CLOCK_MONOTONIC microseconds taken right before
+ * shell_spawn(), so a wall clock step can't kill or extend running commands).
+ * Both the waiting functions return the exit code, SHELL_FAILED, SHELL_TIMED_OUT or SHELL_ABORTED.
+ */
+int shell_exec_with_timeout(char *cmd);
+pid_t shell_spawn(char *cmd);
+int shell_wait_with_timeout(pid_t pid, char *cmd, unsigned long long spawned_mono_us);
+
+/**
+ * Once the drain deadline has passed: shell_abort_running(1) makes every running shell command get
+ * killed at its next poll (SHELL_ABORTED) and every BATCH stop before its next command.
+ * shell_abort_running(0) lets commands run again. shell_aborted_count() returns how many commands
+ * were aborted so far.
+ */
+void shell_abort_running(int on);
+int shell_aborted_count(void);
+
+/**
+ * Object pool helpers (see MyObjectPool above).
+ * pool_alloc() returns a zeroed slot, or NULL only if the malloc fallback fails.
+ * pool_free() accepts NULL and pointers from either the slab or the fallback.
+ */
+void* pool_alloc(MyObjectPool* pool);
+void pool_free(MyObjectPool* pool, void* ptr);
+
+/**
+ * Command-context and thread-handle pools used by server.c / client.c.
+ * Every server worker has its own pair of pools, so workers never share an allocator lock;
+ * pool_bind_worker() (called once by the worker thread) selects them, every other thread
+ * uses the shared pair.
+ */
+void pool_bind_worker(int worker_index);
+ThreadArg* acquire_thread_arg(void);
+void release_thread_arg(ThreadArg* tArg);
+void release_thread_handle(pthread_t* tid);
+
+/**
+ * Prints the allocator counters of every pool (served by the STATS command).
+ */
+void print_pool_stats(void);
+
 /**
  * Creates a POSIX message queue with the given name and max capacity.
  * Returns a pointer to a dynamically allocated MyMessageQueue on success, or NULL on failure.
@@ -81,6 +357,30 @@ int enqueue_message(MyMessageQueue* myObj, MyMessage* msg);
  */
 int dequeue_message(MyMessageQueue* myObj, MyMessage* outMsg);
 
+/**
+ * Like dequeue_message(), but gives up after timeout_ms (0 = only take what is already there).
+ * Returns 0 on success, -1 on failure or timeout (errno == ETIMEDOUT, nothing is printed for that).
+ */
+int dequeue_message_timed(MyMessageQueue* myObj, MyMessage* outMsg, int timeout_ms);
+
+/**
+ * Like enqueue_message(), but gives up after timeout_ms if the queue stays full.
+ * Returns 0 on success, -1 on failure or timeout (errno == ETIMEDOUT, nothing is printed for that).
+ */
+int enqueue_message_timed(MyMessageQueue* myObj, MyMessage* msg, int timeout_ms);
+
+/**
+ * Opens a queue somebody else created (no O_CREAT). Returns NULL if it doesn't exist
+ * (errno == ENOENT, nothing is printed for that) or can't be opened.
+ */
+MyMessageQueue* open_existing_queue(char* name);
+
+/**
+ * Creates a fresh queue only the server's user can open (0600); a stale one is removed first.
+ * Returns NULL on failure.
+ */
+MyMessageQueue* create_private_queue(char* name, long max_messages);
+
 
 /**
  * Creates a client process - logs the setup like the professors code.
@@ -111,5 +411,128 @@ void* child_thread_notification(void* arg);
  */
 pthread_t* spawn_thread_from_pool(void* notification);
 
+/**
+ * Fair scheduler (scheduler.c, linked into the server only).
+ *  scheduler_submit()   queues a message on its client's lane. Returns 0, or -1 if the lane is full / no lane is free.
+ *  scheduler_next()     blocks until some lane may run a command and copies it out. Returns -1 once stopped,
+ *                       or once worker_index is no longer below the worker count (that worker should exit).
+ *  scheduler_complete() tells the scheduler a command handed out by scheduler_next() has finished.
+ *  scheduler_set_weight() / scheduler_set_limits() tune a client's lane (created if needed). Return 0 or -1,
+ *                       except scheduler_set_weight() returns the lane's max_inflight on success (weight only
+ *                       changes anything when that is above 1).
+ *  scheduler_set_worker_count() lets workers at index >= count retire after their current command.
+ *  scheduler_stop()     wakes every waiting worker so they can exit. scheduler_resume() undoes it.
+ */
+int scheduler_submit(MyMessage* msg);
+int scheduler_next(MyMessage* outMsg, int worker_index);
+void scheduler_complete(long client_pid, int client_exited);
+int scheduler_set_weight(long client_pid, int weight);
+int scheduler_set_limits(long client_pid, int max_inflight, double rate);
+void scheduler_set_worker_count(int count);
+void scheduler_stop(void);
+void scheduler_resume(void);
+
+/**
+ * Draining / handover helpers.
+ *  scheduler_wait_idle()   waits until nothing is queued or running. Returns 0, or -1 if timeout_ms passed first.
+ *  scheduler_wait_running() waits until nothing is running (queued commands don't count). Same return values.
+ *  scheduler_take_pending() pops a queued command (lane by lane, oldest first). Returns 0, or -1 when none are left.
+ *  scheduler_putback_pending() puts a command taken by scheduler_take_pending() back at the front of its lane.
+ *  scheduler_export_lane() reads the settings of lane 'index' (0..MAX_CLIENTS-1). Returns 1 if it is in use, else 0.
+ */
+int scheduler_wait_idle(int timeout_ms);
+int scheduler_wait_running(int timeout_ms);
+int scheduler_take_pending(MyMessage* outMsg);
+int scheduler_putback_pending(MyMessage* msg);
+int scheduler_export_lane(int index, long* client_pid, int* weight, int* max_inflight, double* rate);
+void print_scheduler_stats(void);
+
+
+/**
+ * Recording side (only called from the server's ingestion thread, so no locking).
+ * capture_open() returns 0 or -1, capture_write() stamps the arrival time itself,
+ * capture_close() flushes and reports how many records were written.
+ */
+int capture_open(const char* path);
+void capture_write(MyMessage* msg);
+void capture_close(void);
+
+/**
+ * Reading side (used by replay.c).
+ * capture_open_reader() checks the header and returns NULL if it isn't a capture file.
+ * capture_read() returns 1 for a record, 0 at end of file, -1 on a truncated/corrupt record.
+ */
+FILE* capture_open_reader(const char* path);
+int capture_read(FILE* fp, CaptureRecord* out);
+
+/**
+ * Shared counters (see ServerCounters).
+ * counters_create() is the server side (creates or reuses COUNTERS_SHM_NAME), counters_attach()
+ * maps them read-only for ./replay. Both return NULL on failure (attach: no server running).
+ * counters_close() unmaps them and, with 'unlink_on_close', removes the segment.
+ */
+ServerCounters* counters_create(void);
+const ServerCounters* counters_attach(void);
+void counters_close(const ServerCounters* counters, int unlink_on_close);
+
+
+/**
+ * Tracing (tracing.c). Every trace_* call is a cheap no-op until tracing_open() succeeded.
+ *  trace_now_us()          wall clock in microseconds (shared time base for client, server and children)
+ *  trace_set_correlation() / trace_correlation()  the calling thread's current correlation ID
+ *  trace_span()            a complete span [start_us, end_us) on the calling thread
+ *  trace_span_on()         same, for another pid/tid (used for forked children)
+ *  trace_async()           an async 'b'/'e' pair, for waits that overlap other spans (queue/scheduler waits)
+ *  trace_flow()            flow arrow step ('s' start, 't' step, 'f' finish) linking a command across threads
+ *  trace_thread_name()     labels the calling thread in the viewer
+ */
+int tracing_open(const char* path);
+void tracing_close(void);
+int tracing_enabled(void);
+unsigned long long trace_now_us(void);
+void trace_set_correlation(unsigned long corr_id);
+unsigned long trace_correlation(void);
+void trace_span(const char* name, const char* cat, unsigned long long start_us, unsigned long long end_us);
+void trace_span_on(const char* name, const char* cat, long pid, long tid,
+                   unsigned long long start_us, unsigned long long end_us);
+void trace_async(const char* name, const char* cat, unsigned long long start_us, unsigned long long end_us);
+void trace_flow(char phase, unsigned long long ts_us);
+void trace_thread_name(const char* name);
+
+
+/**
+ * Settings (config.c).
+ *  config_snapshot() returns a consistent copy of the current settings.
+ *  config_set() validates and applies one "key", "value" pair. Returns 0, or -1 for an unknown key / bad value.
+ *  config_load() applies every line of a config file. Returns 0, or -1 if the file can't be read or has a bad line.
+ *  print_config() lists the current settings.
+ *  config_mq_msg_max() reads MQ_MSG_MAX_PATH: unless run as root, queue_depth must not exceed it
+ *  or mq_open() fails with EINVAL. Returns -1 if it can't be read.
+ */
+ServerConfig config_snapshot(void);
+int config_set(const char* key, const char* value);
+int config_load(const char* path);
+void print_config(void);
+long config_mq_msg_max(void);
+
+
+/**
+ * Handover (handover.c, server only).
+ *  handover_request()     new server side: asks the running server to hand over and applies what it sends.
+ *                         Returns the number of records received, or -1 if no (complete) handover arrived in time.
+ *  handover_accept()      old server side: checks a "HANDOVER <pid>" request and sends the ACK.
+ *                         Returns 0 if we are handing over, -1 if the request must be ignored.
+ *  handover_heartbeat()   old server side: tells the new server we are still finishing commands. Returns 0 or -1.
+ *  handover_send_state()  old server side: sends settings, registry, lanes and unstarted commands to the new server.
+ *                         Call it after the workers are stopped. Returns 0, or -1 if the new server stopped
+ *                         listening (commands that were not sent are still queued in the scheduler).
+ *  handover_in_progress() 1 if some new server is waiting for a handover (HANDOVER_QUEUE_NAME exists), else 0.
+ */
+int handover_request(MyMessageQueue* serverQueue);
+int handover_accept(long new_server_pid);
+int handover_heartbeat(long new_server_pid);
+int handover_send_state(long new_server_pid);
+int handover_in_progress(void);
+
 
 #endif // PROTOTYPE_DEFS_H
\ No newline at end of file
@@ -0,0 +1,231 @@
+// replay.c
+//
+// Plays a capture file (made with "server --record <file>") back against a running server.
+//   ./replay <file>                 original timing
+//   ./replay <file> --speed 4       4x faster (0.5 = half speed)
+//   ./replay <file> --max           as fast as the queue takes it
+//   --include-shutdown              also send recorded SHUTDOWN messages (skipped by default)
+// Recorded HANDOVER requests (from "server --takeover") are always skipped.
+//
+// The server has no reply channel. What we measure:
+//  - send latency: how long mq_send() took (it blocks while /server_queue is full)
+//  - lag: how far behind the recorded schedule each message went out
+//  - completed / dropped: read from the server's shared counters (ServerCounters), so a
+//    command the server dropped because its lane was full is not mistaken for a handled one
+//  - throughput: completed commands / time until everything we sent was completed or dropped
+// The counters are server-wide, so keep other clients quiet while replaying.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "prototype_defs.h"
+
+#define REPLAY_STALL_SECS 30  // stop waiting for the server after this long without progress
+
+// Helper: nanoseconds between two monotonic timestamps
+static long long diff_ns(struct timespec* from, struct timespec* to)
+{
+    return (long long)(to->tv_sec - from->tv_sec) * 1000000000LL +
+           (long long)(to->tv_nsec - from->tv_nsec);
+}
+
+// Helper: qsort callback
+static int compare_ll(const void* a, const void* b)
+{
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Helper: p-th percentile (0..100) of a sorted array, in microseconds
+static double percentile_us(long long* sorted, long n, double p)
+{
+    if (n == 0) {
+        return 0.0;
+    }
+    long idx = (long)((p / 100.0) * (double)(n - 1) + 0.5);
+    return (double)sorted[idx] / 1000.0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s <capture file> [--speed <factor> | --max] [--include-shutdown]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* path = argv[1];
+    double speed = 1.0;
+    int max_speed = 0;
+    int include_shutdown = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = atof(argv[++i]);
+            if (speed <= 0.0) {
+                fprintf(stderr, "--speed needs a factor > 0\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max") == 0) {
+            max_speed = 1;
+        } else if (strcmp(argv[i], "--include-shutdown") == 0) {
+            include_shutdown = 1;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    FILE* fp = capture_open_reader(path);
+    if (!fp) {
+        return 1;
+    }
+
+    // Never create the queue (or the counters) ourselves, that would just fill a queue nobody reads
+    MyMessageQueue* queue = open_existing_queue("/server_queue");
+    const ServerCounters* counters = counters_attach();
+    if (!queue || !counters) {
+        fprintf(stderr, "replay: could not open /server_queue and %s, is the server running?\n",
+                COUNTERS_SHM_NAME);
+        destroy_message_queue(queue, 0);
+        counters_close(counters, 0);
+        fclose(fp);
+        return 1;
+    }
+    unsigned long base_completed = COUNTER_GET(counters, completed);
+    unsigned long base_dropped   = COUNTER_GET(counters, dropped);
+
+    // Per-message measurements (grown as needed, this is a tool, not the server)
+    long capacity = 1024;
+    long sent = 0, skipped = 0, failed = 0;
+    long long* send_ns = (long long*)malloc(sizeof(long long) * capacity);
+    long long* lag_ns  = (long long*)malloc(sizeof(long long) * capacity);
+    if (!send_ns || !lag_ns) {
+        perror("malloc for replay stats failed");
+        return 1;
+    }
+
+    printf("[replay]: Replaying '%s' at %s...\n", path,
+           max_speed ? "maximum speed" : (speed == 1.0 ? "original speed" : "scaled speed"));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    CaptureRecord rec;
+    int rc;
+    while ((rc = capture_read(fp, &rec)) == 1) {
+        if (!include_shutdown && strcmp(rec.content, "SHUTDOWN") == 0) {
+            skipped++;
+            continue;
+        }
+        if (strncmp(rec.content, "HANDOVER ", 9) == 0) {
+            skipped++;  // a takeover request from a server that is long gone
+            continue;
+        }
+
+        // Wait for this record's (scaled) arrival time
+        long long target_ns = 0;
+        if (!max_speed) {
+            target_ns = (long long)((double)rec.offset_ns / speed);
+            struct timespec due = start;
+            due.tv_sec  += target_ns / 1000000000LL;
+            due.tv_nsec += target_ns % 1000000000LL;
+            if (due.tv_nsec >= 1000000000L) {
+                due.tv_sec++;
+                due.tv_nsec -= 1000000000L;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+        }
+
+        MyMessage msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.client_pid = rec.client_pid;
+        snprintf(msg.content, sizeof(msg.content), "%s", rec.content);
+
+        struct timespec before, after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        if (enqueue_message(queue, &msg) == -1) {
+            failed++;
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &after);
+
+        if (sent == capacity) {
+            capacity *= 2;
+            send_ns = (long long*)realloc(send_ns, sizeof(long long) * capacity);
+            lag_ns  = (long long*)realloc(lag_ns, sizeof(long long) * capacity);
+            if (!send_ns || !lag_ns) {
+                perror("realloc for replay stats failed");
+                return 1;
+            }
+        }
+        send_ns[sent] = diff_ns(&before, &after);
+        lag_ns[sent]  = max_speed ? 0 : diff_ns(&start, &before) - target_ns;
+        sent++;
+    }
+    fclose(fp);
+
+    struct timespec sent_done;
+    clock_gettime(CLOCK_MONOTONIC, &sent_done);
+
+    // Wait until the server completed or dropped everything we sent. Give up once
+    // nothing has moved for REPLAY_STALL_SECS (e.g. the server went away).
+    unsigned long completed = 0, dropped = 0, last_handled = 0;
+    struct timespec last_progress = sent_done;
+    struct timespec drained;
+    while (1) {
+        completed = COUNTER_GET(counters, completed) - base_completed;
+        dropped   = COUNTER_GET(counters, dropped) - base_dropped;
+        clock_gettime(CLOCK_MONOTONIC, &drained);
+        if (completed + dropped >= (unsigned long)sent) {
+            break;
+        }
+        if (completed + dropped != last_handled) {
+            last_handled = completed + dropped;
+            last_progress = drained;
+        } else if (diff_ns(&last_progress, &drained) > REPLAY_STALL_SECS * 1000000000LL) {
+            break;
+        }
+        usleep(10000);
+    }
+    long pending = sent - (long)(completed + dropped);
+
+    destroy_message_queue(queue, 0); // don't unlink, the server owns it
+    counters_close(counters, 0);
+
+    qsort(send_ns, sent, sizeof(long long), compare_ll);
+    qsort(lag_ns, sent, sizeof(long long), compare_ll);
+
+    double send_secs  = (double)diff_ns(&start, &sent_done) / 1e9;
+    double drain_secs = (double)diff_ns(&start, &drained) / 1e9;
+
+    printf("===== Replay Report =====\n");
+    printf(" -> messages sent: %ld (skipped %ld, failed %ld)%s\n", sent, skipped, failed,
+           rc == -1 ? " -- capture file ended with a corrupt record" : "");
+    printf(" -> server: completed %lu, dropped %lu (lane full / no free lane)", completed, dropped);
+    if (pending > 0) {
+        printf(", %ld still pending after %d s without progress", pending, REPLAY_STALL_SECS);
+    }
+    printf("\n");
+    printf(" -> send phase: %.3f s, completed by server after %.3f s\n", send_secs, drain_secs);
+    printf(" -> throughput: %.1f completed cmds/s\n", drain_secs > 0.0 ? (double)completed / drain_secs : 0.0);
+    printf(" -> send latency (us): p50=%.1f p90=%.1f p99=%.1f max=%.1f\n",
+           percentile_us(send_ns, sent, 50), percentile_us(send_ns, sent, 90),
+           percentile_us(send_ns, sent, 99), percentile_us(send_ns, sent, 100));
+    if (!max_speed) {
+        printf(" -> schedule lag (us): p50=%.1f p99=%.1f max=%.1f\n",
+               percentile_us(lag_ns, sent, 50), percentile_us(lag_ns, sent, 99),
+               percentile_us(lag_ns, sent, 100));
+    }
+    printf("=========================\n");
+
+    free(send_ns);
+    free(lag_ns);
+    return rc == -1 ? 1 : 0;
+}
@@ -0,0 +1,498 @@
+// scheduler.c
+//
+// Fair scheduler that sits between the ingestion loop (mq_receive in server.c)
+// and the worker threads that execute commands.
+// Every client gets a lane (a small ring of messages). Workers pick the next
+// command with deficit round robin over the lanes, so a client flooding the
+// queue only ever gets its weighted share of the workers. A BATCH costs as
+// much credit as the number of commands it carries.
+// Per-client in-flight limits and a token bucket rate limit decide whether a
+// lane is allowed to run at all right now.
+
+#include "prototype_defs.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+static ClientLane g_lanes[MAX_CLIENTS];
+static int g_cursor = 0;        // lane DRR is currently serving
+static int g_queuedTotal = 0;   // messages waiting across all lanes
+static int g_inFlightTotal = 0; // commands handed out and not completed yet
+static int g_stopping = 0;
+static int g_workerTarget = SCHED_WORKER_COUNT; // workers at index >= this retire
+static pthread_mutex_t g_schedLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_workReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_idle = PTHREAD_COND_INITIALIZER;    // signalled when a command completes
+
+// Helper: seconds elapsed between two monotonic timestamps
+static double elapsed_sec(struct timespec* from, struct timespec* to)
+{
+    return (double)(to->tv_sec - from->tv_sec) +
+           (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+// Helper: find the lane of a client (caller holds g_schedLock)
+static ClientLane* find_lane(long client_pid)
+{
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (g_lanes[i].pid == client_pid) {
+            return &g_lanes[i];
+        }
+    }
+    return NULL;
+}
+
+// Helper: the idle lane (nothing queued or running) that was used longest ago, or NULL.
+// Clients that quit with Ctrl+C never send EXIT, so their lanes are reclaimed this way.
+static ClientLane* find_stale_lane(void)
+{
+    ClientLane* oldest = NULL;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        ClientLane* lane = &g_lanes[i];
+        if (lane->pid == 0 || lane->count != 0 || lane->in_flight != 0) {
+            continue;
+        }
+        if (!oldest || elapsed_sec(&lane->last_active, &oldest->last_active) > 0.0) {
+            oldest = lane;
+        }
+    }
+    return oldest;
+}
+
+// Helper: find the client's lane or claim a free one with default settings (caller holds g_schedLock)
+static ClientLane* find_or_create_lane(long client_pid)
+{
+    ClientLane* lane = find_lane(client_pid);
+    if (lane) {
+        return lane;
+    }
+    // Respect the live max_clients setting, not just the size of the array
+    ServerConfig cfg = config_snapshot();
+    int active = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (g_lanes[i].pid != 0) {
+            active++;
+        }
+    }
+    lane = active < cfg.max_clients ? find_lane(0) : NULL;
+    if (!lane) {
+        // Every lane is taken: reuse the stalest idle one (its weight/limits are lost)
+        lane = find_stale_lane();
+        if (!lane) {
+            return NULL;  // every lane has work queued or running
+        }
+        printf("[scheduler]: Reclaiming idle lane of client %ld for client %ld\n", lane->pid, client_pid);
+    }
+
+    memset(lane, 0, sizeof(ClientLane));
+    lane->pid          = client_pid;
+    lane->weight       = cfg.default_weight;
+    lane->max_inflight = cfg.default_max_inflight;
+    lane->rate         = cfg.default_rate;
+    lane->tokens       = 1.0;
+    clock_gettime(CLOCK_MONOTONIC, &lane->last_refill);
+    lane->last_active = lane->last_refill;
+    return lane;
+}
+
+// Helper: top up the lane's token bucket. Burst is one second worth of tokens (at least 1).
+static void refill_tokens(ClientLane* lane, struct timespec* now)
+{
+    if (lane->rate <= 0.0) {
+        return;
+    }
+    double burst = lane->rate < 1.0 ? 1.0 : lane->rate;
+    lane->tokens += lane->rate * elapsed_sec(&lane->last_refill, now);
+    if (lane->tokens > burst) {
+        lane->tokens = burst;
+    }
+    lane->last_refill = *now;
+}
+
+// Helper: may this lane start another command right now?
+static int lane_is_eligible(ClientLane* lane)
+{
+    if (lane->in_flight >= lane->max_inflight) {
+        return 0;
+    }
+    if (lane->rate > 0.0 && lane->tokens < 1.0) {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * scheduler_submit()
+ * Copies the message into its client's lane. We never block the ingestion loop:
+ * if the lane is full the command is dropped and counted.
+ */
+int scheduler_submit(MyMessage* msg)
+{
+    pthread_mutex_lock(&g_schedLock);
+
+    ClientLane* lane = find_or_create_lane(msg->client_pid);
+    if (!lane) {
+        pthread_mutex_unlock(&g_schedLock);
+        fprintf(stderr, "scheduler_submit: no free lane for client %ld, dropping '%s'\n",
+                msg->client_pid, msg->content);
+        return -1;
+    }
+    if (lane->count >= config_snapshot().lane_depth) {
+        lane->dropped++;
+        pthread_mutex_unlock(&g_schedLock);
+        fprintf(stderr, "scheduler_submit: lane of client %ld is full, dropping '%s'\n",
+                msg->client_pid, msg->content);
+        return -1;
+    }
+
+    int tail = (lane->head + lane->count) % SCHED_LANE_CAPACITY;
+    lane->ring[tail] = *msg;
+    lane->count++;
+    g_queuedTotal++;
+    clock_gettime(CLOCK_MONOTONIC, &lane->last_active);
+
+    pthread_cond_signal(&g_workReady);
+    pthread_mutex_unlock(&g_schedLock);
+    return 0;
+}
+
+/**
+ * scheduler_next()
+ * Deficit round robin: the lane under the cursor earns weight*quantum credit when
+ * it runs out, and keeps the cursor while it still has credit and work. Lanes that
+ * are over their in-flight or rate limit are skipped; if every lane with work is
+ * limited we sleep for SCHED_RETRY_MS and look again.
+ * A worker whose index is past the configured worker count gets -1 and retires,
+ * it only ever notices between commands so nothing in flight is dropped.
+ */
+int scheduler_next(MyMessage* outMsg, int worker_index)
+{
+    pthread_mutex_lock(&g_schedLock);
+
+    while (!g_stopping && worker_index < g_workerTarget) {
+        if (g_queuedTotal == 0) {
+            pthread_cond_wait(&g_workReady, &g_schedLock);
+            continue;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // Sweep over the lanes starting at the cursor. A lane whose next message costs
+        // more than its credit (a big BATCH) banks credit and we sweep again.
+        int credited = 0;
+        for (int n = 0; n < MAX_CLIENTS; n++) {
+            ClientLane* lane = &g_lanes[g_cursor];
+
+            if (lane->pid == 0 || lane->count == 0) {
+                lane->deficit = 0;  // idle lanes don't bank credit
+                g_cursor = (g_cursor + 1) % MAX_CLIENTS;
+                continue;
+            }
+
+            refill_tokens(lane, &now);
+            if (!lane_is_eligible(lane)) {
+                g_cursor = (g_cursor + 1) % MAX_CLIENTS;
+                continue;
+            }
+
+            int cost = count_batch_commands(lane->ring[lane->head].content);
+            if (lane->deficit < cost) {
+                lane->deficit += SCHED_QUANTUM * lane->weight;
+                credited = 1;
+                if (lane->deficit < cost) {
+                    g_cursor = (g_cursor + 1) % MAX_CLIENTS;
+                    continue;
+                }
+            }
+
+            // Pop the oldest message of this lane
+            *outMsg = lane->ring[lane->head];
+            lane->head = (lane->head + 1) % SCHED_LANE_CAPACITY;
+            lane->count--;
+            g_queuedTotal--;
+
+            lane->deficit -= cost;
+            lane->in_flight++;
+            g_inFlightTotal++;
+            lane->dispatched++;
+            if (lane->rate > 0.0) {
+                lane->tokens -= 1.0;
+            }
+
+            // Move on once this lane spent its credit or ran dry
+            if (lane->deficit < 1 || lane->count == 0) {
+                if (lane->count == 0) {
+                    lane->deficit = 0;
+                }
+                g_cursor = (g_cursor + 1) % MAX_CLIENTS;
+            }
+
+            pthread_mutex_unlock(&g_schedLock);
+            return 0;
+        }
+        if (credited) {
+            continue;
+        }
+
+        // Work is queued but every lane holding it is limited -> retry shortly
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += SCHED_RETRY_MS * 1000000L;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&g_workReady, &g_schedLock, &wake);
+    }
+
+    pthread_mutex_unlock(&g_schedLock);
+    return -1;
+}
+
+/**
+ * scheduler_complete()
+ * Releases the in-flight slot. Once a client has sent EXIT and its lane is drained
+ * the lane is handed back for reuse (lanes of clients that never send EXIT are
+ * reclaimed in find_or_create_lane() when we run out).
+ */
+void scheduler_complete(long client_pid, int client_exited)
+{
+    pthread_mutex_lock(&g_schedLock);
+
+    ClientLane* lane = find_lane(client_pid);
+    if (lane) {
+        if (lane->in_flight > 0) {
+            lane->in_flight--;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &lane->last_active);
+        if (client_exited && lane->count == 0 && lane->in_flight == 0) {
+            lane->pid = 0;
+        }
+    }
+    if (g_inFlightTotal > 0) {
+        g_inFlightTotal--;
+    }
+
+    // A limited lane may have become eligible again, and a drain may be waiting for us
+    pthread_cond_broadcast(&g_workReady);
+    pthread_cond_broadcast(&g_idle);
+    pthread_mutex_unlock(&g_schedLock);
+}
+
+/**
+ * scheduler_set_weight()
+ * A weight of 3 gets three times the share of a weight 1 client while both have work queued.
+ * That share is only usable with max_inflight > 1: at the default of 1 the lane is
+ * ineligible as soon as its one command is dispatched, so the extra credit is never spent.
+ * Returns the lane's max_inflight so the caller can say so.
+ */
+int scheduler_set_weight(long client_pid, int weight)
+{
+    if (client_pid <= 0 || weight < 1) {
+        fprintf(stderr, "scheduler_set_weight: need a client pid and a weight >= 1\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_schedLock);
+    ClientLane* lane = find_or_create_lane(client_pid);
+    int max_inflight = -1;
+    if (lane) {
+        lane->weight = weight;
+        max_inflight = lane->max_inflight;
+    }
+    pthread_mutex_unlock(&g_schedLock);
+
+    return max_inflight;
+}
+
+/**
+ * scheduler_set_limits()
+ * max_inflight >= 1, rate in commands/sec (0 = unlimited).
+ */
+int scheduler_set_limits(long client_pid, int max_inflight, double rate)
+{
+    if (client_pid <= 0 || max_inflight < 1 || rate < 0.0) {
+        fprintf(stderr, "scheduler_set_limits: need a client pid, max_inflight >= 1 and rate >= 0\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_schedLock);
+    ClientLane* lane = find_or_create_lane(client_pid);
+    if (lane) {
+        lane->max_inflight = max_inflight;
+        lane->rate = rate;
+        if (lane->tokens > 1.0 || rate <= 0.0) {
+            lane->tokens = 1.0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &lane->last_refill);
+    }
+    pthread_cond_broadcast(&g_workReady);
+    pthread_mutex_unlock(&g_schedLock);
+
+    return lane ? 0 : -1;
+}
+
+/**
+ * scheduler_set_worker_count()
+ * Wakes everyone so surplus workers notice they should retire.
+ */
+void scheduler_set_worker_count(int count)
+{
+    pthread_mutex_lock(&g_schedLock);
+    g_workerTarget = count;
+    pthread_cond_broadcast(&g_workReady);
+    pthread_mutex_unlock(&g_schedLock);
+}
+
+/**
+ * scheduler_stop()
+ * Wakes all workers blocked in scheduler_next(); they get -1 and exit.
+ */
+void scheduler_stop(void)
+{
+    pthread_mutex_lock(&g_schedLock);
+    g_stopping = 1;
+    pthread_cond_broadcast(&g_workReady);
+    pthread_mutex_unlock(&g_schedLock);
+}
+
+/**
+ * scheduler_resume()
+ * Lets workers pull commands again after scheduler_stop() (a handover that fell through).
+ */
+void scheduler_resume(void)
+{
+    pthread_mutex_lock(&g_schedLock);
+    g_stopping = 0;
+    pthread_mutex_unlock(&g_schedLock);
+}
+
+// Helper: wait on g_idle until nothing is running (and, with 'include_queued', nothing is queued)
+static int wait_until_quiet(int timeout_ms, int include_queued)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&g_schedLock);
+    int rc = 0;
+    while ((include_queued && g_queuedTotal > 0) || g_inFlightTotal > 0) {
+        if (pthread_cond_timedwait(&g_idle, &g_schedLock, &deadline) == ETIMEDOUT) {
+            rc = ((include_queued && g_queuedTotal > 0) || g_inFlightTotal > 0) ? -1 : 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_schedLock);
+    return rc;
+}
+
+/**
+ * scheduler_wait_idle()
+ * Used by the graceful SHUTDOWN: wait for the workers to run down the lanes.
+ */
+int scheduler_wait_idle(int timeout_ms)
+{
+    return wait_until_quiet(timeout_ms, 1);
+}
+
+/**
+ * scheduler_wait_running()
+ * Used while stopping the workers: the queued commands stay put for the handover.
+ */
+int scheduler_wait_running(int timeout_ms)
+{
+    return wait_until_quiet(timeout_ms, 0);
+}
+
+/**
+ * scheduler_take_pending()
+ * Removes one queued command without running it (handover / discarding after a drain timeout).
+ */
+int scheduler_take_pending(MyMessage* outMsg)
+{
+    pthread_mutex_lock(&g_schedLock);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        ClientLane* lane = &g_lanes[i];
+        if (lane->pid != 0 && lane->count > 0) {
+            *outMsg = lane->ring[lane->head];
+            lane->head = (lane->head + 1) % SCHED_LANE_CAPACITY;
+            lane->count--;
+            g_queuedTotal--;
+            pthread_mutex_unlock(&g_schedLock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&g_schedLock);
+    return -1;
+}
+
+/**
+ * scheduler_putback_pending()
+ * Undoes scheduler_take_pending() for a command the handover couldn't send, keeping its lane in order.
+ */
+int scheduler_putback_pending(MyMessage* msg)
+{
+    pthread_mutex_lock(&g_schedLock);
+    ClientLane* lane = find_or_create_lane(msg->client_pid);
+    if (!lane || lane->count >= SCHED_LANE_CAPACITY) {
+        pthread_mutex_unlock(&g_schedLock);
+        fprintf(stderr, "scheduler_putback_pending: no room for client %ld, dropping '%s'\n",
+                msg->client_pid, msg->content);
+        return -1;
+    }
+    lane->head = (lane->head + SCHED_LANE_CAPACITY - 1) % SCHED_LANE_CAPACITY;
+    lane->ring[lane->head] = *msg;
+    lane->count++;
+    g_queuedTotal++;
+    pthread_cond_signal(&g_workReady);
+    pthread_mutex_unlock(&g_schedLock);
+    return 0;
+}
+
+int scheduler_export_lane(int index, long* client_pid, int* weight, int* max_inflight, double* rate)
+{
+    if (index < 0 || index >= MAX_CLIENTS) {
+        return 0;
+    }
+    pthread_mutex_lock(&g_schedLock);
+    ClientLane* lane = &g_lanes[index];
+    int in_use = lane->pid != 0;
+    if (in_use) {
+        *client_pid   = lane->pid;
+        *weight       = lane->weight;
+        *max_inflight = lane->max_inflight;
+        *rate         = lane->rate;
+    }
+    pthread_mutex_unlock(&g_schedLock);
+    return in_use;
+}
+
+/**
+ * print_scheduler_stats()
+ * One line per active lane (served by the SCHED command).
+ */
+void print_scheduler_stats(void)
+{
+    pthread_mutex_lock(&g_schedLock);
+    printf("===== Scheduler Lanes =====\n");
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        ClientLane* lane = &g_lanes[i];
+        if (lane->pid == 0) {
+            continue;
+        }
+        printf(" -> Client PID: %ld weight=%d queued=%d in_flight=%d/%d rate=%.1f/s dispatched=%lu dropped=%lu\n",
+               lane->pid, lane->weight, lane->count, lane->in_flight, lane->max_inflight,
+               lane->rate, lane->dispatched, lane->dropped);
+    }
+    printf(" -> total queued: %d\n", g_queuedTotal);
+    printf("===========================\n");
+    pthread_mutex_unlock(&g_schedLock);
+}
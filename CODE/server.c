@@ -4,62 +4,417 @@
 #include <pthread.h>  // pthread_self()
 #include <stdlib.h>   // for exit
 #include <string.h>   // for strcmp
+#include <stdint.h>   // intptr_t for the worker index
+#include <errno.h>    // EINVAL from mq_open
 #include "prototype_defs.h"
 
 // Suppose we have a global or static pointer to our server queue
 static MyMessageQueue* g_outgoing_queue = NULL;
 
+// Received/completed/dropped counts in shared memory, read by ./replay
+static ServerCounters* g_counters = NULL;
+
+// Executor threads that pull commands out of the fair scheduler.
+// The pool can be resized with CONFIG worker_count=N, so each slot tracks its state:
+// 0 = no thread, 1 = running, 2 = exited but not joined yet
+static pthread_t g_workers[SCHED_MAX_WORKERS];
+static int g_workerState[SCHED_MAX_WORKERS];
+static int g_workerCount = 0;
+static int g_poolStopping = 0;
+static pthread_mutex_t g_poolLock = PTHREAD_MUTEX_INITIALIZER;
+
 // Helper function: spawns a child thread that handles a command
 // (In real life, we could pass more data to the thread so it can do real work.)
-void handle_command_in_thread(char* command, long client_pid) {
+// Returns 1 if the command (or a BATCH) ran EXIT for the client, 0 otherwise.
+int handle_command_in_thread(char* command, long client_pid, unsigned long corr_id) {
     pthread_t main_thread_id = pthread_self();
 
-    // 1) Log that the main thread received the command
-    printf("[Main Thread -- %lu]: Received command '%s' from the client (PID: %ld). About to create a child thread.\n",
+    // 1) Log that the worker thread picked up the command
+    printf("[Worker Thread -- %lu]: Received command '%s' from the client (PID: %ld). About to create a child thread.\n",
            (unsigned long)main_thread_id, command, client_pid);
 
 
-    // 1) Allocate and fill ThreadArg creating the argument to pass to the child thread
-    ThreadArg* tArg = (ThreadArg*)malloc(sizeof(ThreadArg));
+    // 1) Take a ThreadArg from the pool (already zeroed) and fill it for the child thread
+    ThreadArg* tArg = acquire_thread_arg();
     if (!tArg) {
         perror("Failed to allocate ThreadArg");
-        return;
+        return 0;
     }
-    memset(tArg, 0, sizeof(ThreadArg));
 
     strncpy(tArg->command, command, sizeof(tArg->command)-1);
     tArg->client_pid = client_pid;
+    tArg->corr_id = corr_id;
 
 
     // 2) Use spawn_thread_from_pool() with tArg
     //spawn_thread_from_pool() is defined in prototype_defs.c and uses pthread_create, passes in a function that handles the work on the child threads
     pthread_t* child_tid = spawn_thread_from_pool((void*)tArg); 
     if (!child_tid) {
-        fprintf(stderr, "[Main Thread -- %lu]: spawn_thread_from_pool failed!\n",
+        fprintf(stderr, "[Worker Thread -- %lu]: spawn_thread_from_pool failed!\n",
                 (unsigned long)main_thread_id);
-        free(tArg); // must free if the thread won't use it
-        return;
+        release_thread_arg(tArg); // must give it back if the thread won't use it
+        return 0;
     }
 
     // 3) Log success
-    printf("[Main Thread -- %lu]: Created child thread [%lu]\n",
+    printf("[Worker Thread -- %lu]: Created child thread [%lu]\n",
            (unsigned long)main_thread_id, (unsigned long)*child_tid);
 
-    // 4) Wait for child to finish
-    pthread_join(*child_tid, NULL);
+    // 4) Wait for child to finish, it tells us whether the client sent EXIT
+    void* exited = NULL;
+    pthread_join(*child_tid, &exited);
 
     // 5) Log exit
-    printf("[Main Thread -- %lu]: Child thread [%lu] is finished.\n",
+    printf("[Worker Thread -- %lu]: Child thread [%lu] is finished.\n",
            (unsigned long)main_thread_id, (unsigned long)*child_tid);
 
-    free(child_tid); // done with that pointer
+    release_thread_handle(child_tid); // done with that handle
+    return exited != NULL;
+}
+
+// Worker loop: take the next command the fair scheduler picks and run it.
+// Exits when the server stops or when the pool shrank below this worker's index.
+void* worker_thread_func(void* arg) {
+    int index = (int)(intptr_t)arg;
+    MyMessage msg;
+    trace_thread_name("worker");
+    pool_bind_worker(index);  // this worker's own ThreadArg/pthread_t pools
+    while (1) {
+        if (scheduler_next(&msg, index) == -1) {
+            // Decide under the pool lock, so a resize can't miss us on our way out
+            pthread_mutex_lock(&g_poolLock);
+            if (!g_poolStopping && index < g_workerCount) {
+                pthread_mutex_unlock(&g_poolLock);
+                continue;  // the pool grew back before we left
+            }
+            g_workerState[index] = 2;
+            pthread_mutex_unlock(&g_poolLock);
+            break;
+        }
+
+        unsigned long long picked = trace_now_us();
+        trace_set_correlation(msg.corr_id);
+        trace_async("sched_wait", "server", msg.received_us, picked);
+        trace_flow('t', picked);
+
+        int exited = handle_command_in_thread(msg.content, msg.client_pid, msg.corr_id);
+        scheduler_complete(msg.client_pid, exited);
+        COUNTER_INC(g_counters, completed);
+
+        trace_span("dispatch", "server", picked, trace_now_us());
+    }
+    return NULL;
+}
+
+// Grows or shrinks the executor pool. New slots get a thread right away; surplus
+// workers finish the command they're running and then retire by themselves.
+// Returns the number of workers now running (or about to).
+int resize_worker_pool(int count) {
+    pthread_mutex_lock(&g_poolLock);
+    g_workerCount = count;
+    scheduler_set_worker_count(count);
+
+    int running = 0;
+    for (int i = 0; i < count; i++) {
+        if (g_workerState[i] == 2) {
+            pthread_join(g_workers[i], NULL);  // retired earlier, reuse the slot
+            g_workerState[i] = 0;
+        }
+        if (g_workerState[i] == 0) {
+            if (pthread_create(&g_workers[i], NULL, worker_thread_func, (void*)(intptr_t)i) != 0) {
+                perror("pthread_create for worker failed");
+                continue;
+            }
+            g_workerState[i] = 1;
+        }
+        running++;
+    }
+    pthread_mutex_unlock(&g_poolLock);
+    return running;
+}
+
+static void handover_tick(long* handover_pid);
+
+// Stops every worker (each finishes the command it is running) and joins them.
+// With 'handover_pid', handover_tick() runs every HANDOVER_HEARTBEAT_MS while we wait.
+void stop_worker_pool(long* handover_pid) {
+    pthread_mutex_lock(&g_poolLock);
+    g_poolStopping = 1;
+    pthread_mutex_unlock(&g_poolLock);
+
+    scheduler_stop();
+    if (handover_pid) {
+        while (scheduler_wait_running(HANDOVER_HEARTBEAT_MS) == -1) {
+            handover_tick(handover_pid);
+        }
+    }
+
+    // Nobody resizes the pool anymore, so we can join without holding the lock
+    for (int i = 0; i < SCHED_MAX_WORKERS; i++) {
+        if (g_workerState[i] != 0) {
+            pthread_join(g_workers[i], NULL);
+            g_workerState[i] = 0;
+        }
+    }
+}
+
+// Starts the pool again after stop_worker_pool() (a handover that fell through)
+void restart_worker_pool(void) {
+    pthread_mutex_lock(&g_poolLock);
+    g_poolStopping = 0;
+    pthread_mutex_unlock(&g_poolLock);
+
+    scheduler_resume();
+    resize_worker_pool(config_snapshot().worker_count);
+}
+
+// CONFIG                  -> print the current settings
+// CONFIG key=value ...    -> change settings on the live server
+// Changes only come in on /server_admin (admin_thread_func), a bare CONFIG also on /server_queue.
+// Nothing that is already queued or running is dropped: a smaller pool drains, new limits
+// apply to the next command.
+// Returns 1 if the message was a CONFIG command, 0 otherwise.
+int handle_config_command(MyMessage* msg) {
+    pthread_t self_id = pthread_self();
+
+    if (strncmp(msg->content, "CONFIG", 6) != 0 ||
+        (msg->content[6] != '\0' && msg->content[6] != ' ')) {
+        return 0;
+    }
+
+    char settings[MAX_MSG_CONTENT];
+    snprintf(settings, sizeof(settings), "%s", msg->content + 6);
+
+    int changed = 0;
+    char* save = NULL;
+    for (char* pair = strtok_r(settings, " ", &save); pair; pair = strtok_r(NULL, " ", &save)) {
+        char* eq = strchr(pair, '=');
+        if (!eq) {
+            fprintf(stderr, "[Admin Thread -- %lu]: CONFIG expects key=value, got '%s'\n",
+                    (unsigned long)self_id, pair);
+            continue;
+        }
+        *eq = '\0';
+        if (config_set(pair, eq + 1) == 0) {
+            printf("[Admin Thread -- %lu]: CONFIG %s = %s\n", (unsigned long)self_id, pair, eq + 1);
+            if (strcmp(pair, "queue_depth") == 0) {
+                printf("[Admin Thread -- %lu]: (queue_depth applies when /server_queue is next created)\n",
+                       (unsigned long)self_id);
+            }
+            changed = 1;
+        }
+    }
+
+    if (changed) {
+        int workers = config_snapshot().worker_count;
+        if (workers != g_workerCount) {
+            resize_worker_pool(workers);
+            printf("[Admin Thread -- %lu]: Worker pool resized to %d threads.\n",
+                   (unsigned long)self_id, workers);
+        }
+    } else {
+        print_config();
+    }
+    return 1;
+}
+
+// Scheduler control commands are handled right away, not queued, so they can't get stuck
+// behind the very client they are meant to throttle:
+//   WEIGHT <pid> <weight>                       (only on /server_admin)
+//   LIMIT <pid> <max_inflight> <rate_per_sec>   (only on /server_admin)
+//   SCHED
+// Returns 1 if the message was one of them, 0 otherwise.
+int handle_scheduler_command(MyMessage* msg) {
+    pthread_t self_id = pthread_self();
+    long pid;
+    int weight, max_inflight;
+    double rate;
+
+    if (sscanf(msg->content, "WEIGHT %ld %d", &pid, &weight) == 2) {
+        int max_inflight_now = scheduler_set_weight(pid, weight);
+        if (max_inflight_now > 0) {
+            printf("[Admin Thread -- %lu]: Client %ld now has weight %d.\n",
+                   (unsigned long)self_id, pid, weight);
+            if (max_inflight_now == 1) {
+                printf("[Admin Thread -- %lu]: (client %ld runs 1 command at a time, weight has no effect until LIMIT allows more)\n",
+                       (unsigned long)self_id, pid);
+            }
+        }
+        return 1;
+    }
+    if (sscanf(msg->content, "LIMIT %ld %d %lf", &pid, &max_inflight, &rate) == 3) {
+        if (scheduler_set_limits(pid, max_inflight, rate) == 0) {
+            printf("[Admin Thread -- %lu]: Client %ld now limited to %d in flight, %.1f cmds/sec.\n",
+                   (unsigned long)self_id, pid, max_inflight, rate);
+        }
+        return 1;
+    }
+    if (strcmp(msg->content, "SCHED") == 0) {
+        print_scheduler_stats();
+        return 1;
+    }
+    return 0;
+}
+
+// Settings changes are refused on /server_queue, any client can write to that one
+static int is_admin_command(const char* content) {
+    return strncmp(content, "CONFIG ", 7) == 0 ||
+           strncmp(content, "WEIGHT ", 7) == 0 ||
+           strncmp(content, "LIMIT ", 6) == 0;
+}
+
+// Reads /server_admin (see ADMIN_QUEUE_NAME) until admin_stop() is called
+static MyMessageQueue* g_admin_queue = NULL;
+static pthread_t g_adminThread;
+static volatile int g_adminStopping = 0;
+
+void* admin_thread_func(void* arg) {
+    (void)arg;
+    trace_thread_name("admin");
+    while (!g_adminStopping) {
+        MyMessage msg;
+        if (dequeue_message_timed(g_admin_queue, &msg, HANDOVER_HEARTBEAT_MS / 4) == -1) {
+            if (errno == ETIMEDOUT) {
+                continue;
+            }
+            break;
+        }
+        if (!handle_scheduler_command(&msg) && !handle_config_command(&msg)) {
+            fprintf(stderr, "[Admin Thread -- %lu]: Not an admin command: '%s'\n",
+                    (unsigned long)pthread_self(), msg.content);
+        }
+    }
+    return NULL;
+}
+
+// Stops the admin thread before the worker pool goes down, so CONFIG can't resize it meanwhile
+static void admin_stop(void) {
+    if (!g_admin_queue) {
+        return;
+    }
+    g_adminStopping = 1;
+    pthread_join(g_adminThread, NULL);
+}
+
+// What the ingestion loop should do after ingest_message()
+#define INGEST_CONTINUE 0
+#define INGEST_SHUTDOWN 1
+#define INGEST_HANDOVER 2
+
+static unsigned long g_corrSeq = 0;
+
+// Stamps, records and routes one message taken off /server_queue:
+// SHUTDOWN / HANDOVER end the loop, control commands run right here,
+// everything else is queued on the sender's scheduler lane.
+int ingest_message(MyMessage* incoming, long* handover_pid) {
+    pthread_t main_thread_id = pthread_self();
+    long new_pid;
+
+    capture_write(incoming);
+    COUNTER_INC(g_counters, received);
+
+    // Messages without a correlation ID (e.g. from ./replay) get a server-side one
+    unsigned long long dequeued = trace_now_us();
+    incoming->received_us = dequeued;
+    if (incoming->corr_id == 0) {
+        incoming->corr_id = ((unsigned long)getpid() << 32) | ++g_corrSeq;
+    }
+    trace_set_correlation(incoming->corr_id);
+    if (incoming->sent_us != 0) {
+        trace_async("queue_wait", "server", incoming->sent_us, dequeued);
+    }
+
+    // If command is "SHUTDOWN", stop taking new work and drain
+    if (strcmp(incoming->content, "SHUTDOWN") == 0) {
+        printf("[Main Thread -- %lu]: Received SHUTDOWN, cleaning up...\n",
+               (unsigned long)main_thread_id);
+        return INGEST_SHUTDOWN;
+    }
+
+    // "HANDOVER <pid>" comes from a new server started with --takeover
+    // (or from anybody else, handover_accept() checks that the server is real and waiting)
+    if (sscanf(incoming->content, "HANDOVER %ld", &new_pid) == 1) {
+        if (new_pid == (long)getpid()) {
+            return INGEST_CONTINUE;  // our own request, nobody was there to answer it
+        }
+        if (handover_accept(new_pid) == -1) {
+            COUNTER_INC(g_counters, completed);  // handled by ignoring it
+            return INGEST_CONTINUE;
+        }
+        printf("[Main Thread -- %lu]: Server %ld asked to take over.\n",
+               (unsigned long)main_thread_id, new_pid);
+        *handover_pid = new_pid;
+        return INGEST_HANDOVER;
+    }
+
+    if (is_admin_command(incoming->content)) {
+        fprintf(stderr, "[Main Thread -- %lu]: Client %ld sent '%s' on /server_queue, ignored "
+                "(settings can only be changed on %s).\n",
+                (unsigned long)main_thread_id, incoming->client_pid, incoming->content, ADMIN_QUEUE_NAME);
+        COUNTER_INC(g_counters, completed);  // handled by refusing it
+        return INGEST_CONTINUE;
+    }
+    if (handle_scheduler_command(incoming) || handle_config_command(incoming)) {
+        COUNTER_INC(g_counters, completed);
+        return INGEST_CONTINUE;
+    }
+
+    // For everything else, queue it on the client's lane; a worker spawns the child thread
+    if (scheduler_submit(incoming) == -1) {
+        COUNTER_INC(g_counters, dropped);
+    }
+    trace_span("dequeue", "server", dequeued, trace_now_us());
+    return INGEST_CONTINUE;
+}
+
+// Called every HANDOVER_HEARTBEAT_MS while the server waits on its workers during SHUTDOWN
+// or a handover. Keeps an accepted new server posted; otherwise checks whether a new server
+// started waiting on us meanwhile and, if so, reads /server_queue up to its HANDOVER.
+static void handover_tick(long* handover_pid) {
+    if (*handover_pid != 0) {
+        handover_heartbeat(*handover_pid);
+        return;
+    }
+    if (!handover_in_progress()) {
+        return;
+    }
+    MyMessage incoming;
+    long new_pid = 0;
+    while (*handover_pid == 0 && dequeue_message_timed(g_outgoing_queue, &incoming, 0) == 0) {
+        if (strcmp(incoming.content, "SHUTDOWN") == 0) {
+            continue;  // already shutting down
+        }
+        if (ingest_message(&incoming, &new_pid) == INGEST_HANDOVER) {
+            *handover_pid = new_pid;
+        }
+    }
+}
+
+// Gives the workers up to drain_ms to run down the lanes, ticking the handover meanwhile.
+// Returns 0 once nothing is queued or running, -1 if the deadline passed first.
+static int drain_lanes(int drain_ms, long* handover_pid) {
+    int waited = 0;
+    while (1) {
+        int step = drain_ms - waited;
+        if (handover_pid && step > HANDOVER_HEARTBEAT_MS) {
+            step = HANDOVER_HEARTBEAT_MS;
+        }
+        if (scheduler_wait_idle(step) == 0) {
+            return 0;
+        }
+        waited += step;
+        if (waited >= drain_ms || !handover_pid) {
+            return -1;
+        }
+        handover_tick(handover_pid);
+    }
 }
 
 // The child thread might do various tasks like “register client,” “hide,” etc.
 // But in our demonstration, the child_thread_notification is already printing a simple message.
 // If you want more advanced logic, you'd pass an argument and handle it in the thread.
 
-int main(void) {
+int main(int argc, char* argv[]) {
     // Grab basic PIDs/threads for logging
     pid_t server_pid  = getpid();
     pid_t parent_pid  = getppid();
@@ -73,43 +428,191 @@ printf("|-----------------------------------------------------------------------
        server_pid);
     printf("[Main Thread -- %lu]: This is the Server's Main Thread. the Parent Process is (PID: %d)...\n", (unsigned long)main_thread, parent_pid);
 
+    // Optional: --config <file> loads settings (see config.c)
+    //           --record <file> captures every incoming message for ./replay
+    //           --trace <file> writes Chrome trace spans for every command
+    //           --takeover takes over from a running server (see handover.c)
+    const char* config_path = NULL;
+    int takeover = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--takeover") == 0) {
+            takeover = 1;
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            config_path = argv[i + 1];
+            if (config_load(argv[++i]) == -1) {
+                fprintf(stderr, "[Main Thread -- %lu]: Problems in config file '%s' (see above).\n",
+                        (unsigned long)main_thread, argv[i]);
+            } else {
+                printf("[Main Thread -- %lu]: Loaded settings from '%s'.\n", (unsigned long)main_thread, argv[i]);
+            }
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            if (capture_open(argv[++i]) == -1) {
+                exit(1);
+            }
+            printf("[Main Thread -- %lu]: Recording incoming messages to '%s'.\n",
+                   (unsigned long)main_thread, argv[i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            if (tracing_open(argv[++i]) == -1) {
+                exit(1);
+            }
+            trace_thread_name("server main");
+            printf("[Main Thread -- %lu]: Writing trace spans to '%s'.\n",
+                   (unsigned long)main_thread, argv[i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--config <file>] [--record <capture file>] [--trace <trace file>] [--takeover]\n", argv[0]);
+            exit(1);
+        }
+    }
+
     // 1) Create server message queue
-    g_outgoing_queue = create_custom_queue("/server_queue", 10); // referring to the exact same kernel-level message queue object as client.c
+    ServerConfig cfg = config_snapshot();
+    g_outgoing_queue = create_custom_queue("/server_queue", cfg.queue_depth); // referring to the exact same kernel-level message queue object as client.c
     if (!g_outgoing_queue) {
+        long msg_max = config_mq_msg_max();
+        if (errno == EINVAL && msg_max > 0 && cfg.queue_depth > msg_max) {
+            fprintf(stderr, "[Main Thread -- %lu]: queue_depth = %d is above the system limit %ld (%s), "
+                    "lower queue_depth or raise the limit as root.\n",
+                    (unsigned long)main_thread, cfg.queue_depth, msg_max, MQ_MSG_MAX_PATH);
+        }
         fprintf(stderr, "[Main Thread -- %lu]: ERROR creating server queue! Exiting...\n",
                 (unsigned long)main_thread);
         exit(1);
     }
 
+    g_counters = counters_create();  // optional, only ./replay reads them
+
     printf("[Main Thread -- %lu]: Broadcast message queue & Server message queue created. Waiting for the client messages...\n", (unsigned long)main_thread);
 
-    // 2) Simulate waiting for commands from clients by reading from the queue in a loop
+    // Taking over: get settings, registry, lanes and unstarted commands from the running server.
+    // An explicit --config file still wins over the settings handed across.
+    if (takeover) {
+        printf("[Main Thread -- %lu]: Asking the running server to hand over...\n", (unsigned long)main_thread);
+        int records = handover_request(g_outgoing_queue);
+        if (records >= 0) {
+            printf("[Main Thread -- %lu]: Took over %d records from the previous server.\n",
+                   (unsigned long)main_thread, records);
+        }
+        if (config_path) {
+            config_load(config_path);
+        }
+        cfg = config_snapshot();
+    }
+
+    // 2) Start the executor pool, the main thread only does ingestion from here on
+    int started = resize_worker_pool(cfg.worker_count);
+    if (started == 0) {
+        fprintf(stderr, "[Main Thread -- %lu]: Could not start any worker threads! Exiting...\n",
+                (unsigned long)main_thread);
+        exit(1);
+    }
+    printf("[Main Thread -- %lu]: Started %d worker threads behind the fair scheduler.\n",
+           (unsigned long)main_thread, started);
+
+    // Only created now: during a takeover the old server may still be reading its /server_admin
+    g_admin_queue = create_private_queue(ADMIN_QUEUE_NAME, ADMIN_QUEUE_DEPTH);
+    if (g_admin_queue && pthread_create(&g_adminThread, NULL, admin_thread_func, NULL) != 0) {
+        perror("pthread_create for admin thread failed");
+        destroy_message_queue(g_admin_queue, 1);
+        g_admin_queue = NULL;
+    }
+    if (!g_admin_queue) {
+        fprintf(stderr, "[Main Thread -- %lu]: No %s, settings can't be changed while running.\n",
+                (unsigned long)main_thread, ADMIN_QUEUE_NAME);
+    }
+
+    // 3) Read commands from clients in a loop and hand them to the scheduler
     //    maybe in a real server, this might run forever until a shutdown signal.
-    while (1) {
+    long handover_pid = 0;
+    int action = INGEST_CONTINUE;
+    while (action == INGEST_CONTINUE) {
         MyMessage incoming;
         if (dequeue_message(g_outgoing_queue, &incoming) == -1) {
             // some error or queue closed
             break;
         }
+        action = ingest_message(&incoming, &handover_pid);
+    }
+    admin_stop();
 
-        // If command is "SHUTDOWN", break
-        if (strcmp(incoming.content, "SHUTDOWN") == 0) {
-            printf("[Main Thread -- %lu]: Received SHUTDOWN, cleaning up...\n", 
+    int drain_ms = config_snapshot().drain_timeout_ms;
+    if (action == INGEST_HANDOVER) {
+        // 4a) Handover: stop reading /server_queue (new messages wait there for the new server),
+        //     let running commands finish, then pass everything else across
+        printf("[Main Thread -- %lu]: Handing over to server %ld, finishing running commands...\n",
+               (unsigned long)main_thread, handover_pid);
+        stop_worker_pool(&handover_pid);
+    } else {
+        // 4b) Graceful drain: take in what clients already sent, then give the workers
+        //     drain_timeout_ms to finish everything queued and running. A new server that
+        //     asks to take over meanwhile gets whatever is left once we are done.
+        MyMessage incoming;
+        while (handover_pid == 0 && dequeue_message_timed(g_outgoing_queue, &incoming, 0) == 0) {
+            if (strcmp(incoming.content, "SHUTDOWN") == 0) {
+                continue;  // already shutting down
+            }
+            ingest_message(&incoming, &handover_pid);  // sets handover_pid for an accepted HANDOVER
+        }
+        printf("[Main Thread -- %lu]: Draining, waiting up to %d ms for queued and running commands...\n",
+               (unsigned long)main_thread, drain_ms);
+        if (drain_lanes(drain_ms, &handover_pid) == -1) {
+            printf("[Main Thread -- %lu]: Drain deadline passed, aborting the running commands.\n",
                    (unsigned long)main_thread);
-            break;
+            shell_abort_running(1);
+        }
+
+        // Stop the workers (each finishes, or after the deadline aborts, the command it is running)
+        stop_worker_pool(&handover_pid);
+    }
+
+    // If the new server went away before taking everything, run what is left here instead
+    if (handover_pid != 0 && handover_send_state(handover_pid) == -1) {
+        printf("[Main Thread -- %lu]: Handover to server %ld failed, draining the queued commands here.\n",
+               (unsigned long)main_thread, handover_pid);
+        shell_abort_running(0);
+        restart_worker_pool();
+        if (drain_lanes(drain_ms, NULL) == -1) {
+            printf("[Main Thread -- %lu]: Drain deadline passed, aborting the running commands.\n",
+                   (unsigned long)main_thread);
+            shell_abort_running(1);
         }
+        stop_worker_pool(NULL);
+    }
+
+    MyMessage leftover;
+    int dropped = 0;
+    while (scheduler_take_pending(&leftover) == 0) {
+        dropped++;
+        COUNTER_INC(g_counters, dropped);
+    }
+    if (dropped > 0) {
+        printf("[Main Thread -- %lu]: %d queued commands were not run before the deadline.\n",
+               (unsigned long)main_thread, dropped);
+    }
+    if (shell_aborted_count() > 0) {
+        printf("[Main Thread -- %lu]: %d commands (running or next in a BATCH) were aborted at the deadline.\n",
+               (unsigned long)main_thread, shell_aborted_count());
+    }
 
-        // For everything else, spawn a child thread
-        handle_command_in_thread(incoming.content, incoming.client_pid);
+    // Unlink /server_queue (and the counters) only if no new server is (or may soon be) using them
+    // (/server_admin too: a new server has already replaced it with its own)
+    if (handover_pid != 0 || handover_in_progress()) {
+        destroy_message_queue(g_outgoing_queue, 0);
+        destroy_message_queue(g_admin_queue, 0);
+        counters_close(g_counters, 0);
+    } else {
+        destroy_message_queue(g_outgoing_queue, 1);
+        destroy_message_queue(g_admin_queue, 1);
+        counters_close(g_counters, 1);
     }
 
-    // 3) Destroy the queue (unlink = 1 so it disappears from the system)
-    destroy_message_queue(g_outgoing_queue, 1);
+    // 5) Flush everything that is still buffered
+    capture_close();
+    tracing_close();
 
     // Print final message
     printf("[Main Thread -- %lu]: Server is shutting down, all resources cleaned up.\n",
            (unsigned long)main_thread);
+    fflush(stdout);
 
     return 0;
 }
-
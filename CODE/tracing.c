@@ -0,0 +1,221 @@
+// tracing.c
+//
+// Optional Chrome trace (chrome://tracing, ui.perfetto.dev) export of each
+// command's lifecycle: client enqueue, queue wait, dequeue, scheduler wait,
+// dispatch, fork, exec, wait and reply, all tagged with the command's correlation ID.
+//
+// Hot path cost: a mutex and a struct copy into an in-memory buffer. Events are
+// only formatted to JSON and written when the buffer fills up (or on close).
+// The file is opened O_APPEND and every flush is one write(), so a client and the
+// server can share one trace file and their events stay whole.
+
+#include "prototype_defs.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+static int g_traceFd = -1;
+static TraceEvent g_traceEvents[TRACE_BUFFER_EVENTS];
+static int g_traceCount = 0;
+static char g_traceText[TRACE_BUFFER_EVENTS * 2 * 256]; // 'b' events expand into two lines
+static pthread_mutex_t g_traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Correlation ID of whatever command the calling thread is working on
+static __thread unsigned long t_corrId = 0;
+
+// Helper: kernel thread ID, so the viewer shows real TIDs instead of pthread_t addresses
+static long current_tid(void)
+{
+    return (long)syscall(SYS_gettid);
+}
+
+// Helper: format everything buffered and write it out (caller holds g_traceLock)
+static void flush_locked(void)
+{
+    size_t used = 0;
+    size_t cap = sizeof(g_traceText);
+
+    for (int i = 0; i < g_traceCount; i++) {
+        TraceEvent* ev = &g_traceEvents[i];
+        int n = 0;
+
+        switch (ev->phase) {
+        case 'X':
+            n = snprintf(g_traceText + used, cap - used,
+                         "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                         "\"pid\":%ld,\"tid\":%ld,\"args\":{\"corr\":\"%lx\"}},\n",
+                         ev->name, ev->cat, ev->ts_us, ev->dur_us, ev->pid, ev->tid, ev->corr_id);
+            break;
+        case 'b':
+            n = snprintf(g_traceText + used, cap - used,
+                         "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":\"%lx\",\"ts\":%llu,"
+                         "\"pid\":%ld,\"tid\":%ld,\"args\":{\"corr\":\"%lx\"}},\n"
+                         "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":\"%lx\",\"ts\":%llu,"
+                         "\"pid\":%ld,\"tid\":%ld},\n",
+                         ev->name, ev->cat, ev->corr_id, ev->ts_us, ev->pid, ev->tid, ev->corr_id,
+                         ev->name, ev->cat, ev->corr_id, ev->ts_us + ev->dur_us, ev->pid, ev->tid);
+            break;
+        case 's':
+        case 't':
+        case 'f':
+            n = snprintf(g_traceText + used, cap - used,
+                         "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"id\":\"%lx\",\"ts\":%llu,"
+                         "\"pid\":%ld,\"tid\":%ld,\"bp\":\"e\"},\n",
+                         ev->name, ev->cat, ev->phase, ev->corr_id, ev->ts_us, ev->pid, ev->tid);
+            break;
+        case 'M':
+            n = snprintf(g_traceText + used, cap - used,
+                         "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,"
+                         "\"args\":{\"name\":\"%s\"}},\n",
+                         ev->pid, ev->tid, ev->name);
+            break;
+        }
+
+        if (n < 0 || (size_t)n >= cap - used) {
+            break;  // can't happen with 256 bytes per line, but never overrun
+        }
+        used += (size_t)n;
+    }
+
+    size_t off = 0;
+    while (off < used) {
+        ssize_t w = write(g_traceFd, g_traceText + off, used - off);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write to trace file failed");
+            break;
+        }
+        off += (size_t)w;
+    }
+    g_traceCount = 0;
+}
+
+// Helper: append one event, flushing first if the buffer is full
+static void record_event(TraceEvent* ev)
+{
+    pthread_mutex_lock(&g_traceLock);
+    if (g_traceFd < 0) {
+        pthread_mutex_unlock(&g_traceLock);
+        return;
+    }
+    if (g_traceCount == TRACE_BUFFER_EVENTS) {
+        flush_locked();
+    }
+    g_traceEvents[g_traceCount++] = *ev;
+    pthread_mutex_unlock(&g_traceLock);
+}
+
+/**
+ * tracing_open()
+ * Opens (or creates) the trace file. Whoever creates it writes the opening '['.
+ */
+int tracing_open(const char* path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (fd >= 0) {
+        if (write(fd, "[\n", 2) != 2) {
+            perror("write to trace file failed");
+        }
+    } else if (errno == EEXIST) {
+        fd = open(path, O_WRONLY | O_APPEND);
+    }
+    if (fd < 0) {
+        perror("open for trace file failed");
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_traceLock);
+    g_traceFd = fd;
+    g_traceCount = 0;
+    pthread_mutex_unlock(&g_traceLock);
+    return 0;
+}
+
+/**
+ * tracing_close()
+ * Writes out whatever is still buffered. The closing ']' is left off on purpose
+ * (other processes may still be appending, and the viewers don't need it).
+ */
+void tracing_close(void)
+{
+    pthread_mutex_lock(&g_traceLock);
+    if (g_traceFd >= 0) {
+        flush_locked();
+        close(g_traceFd);
+        g_traceFd = -1;
+    }
+    pthread_mutex_unlock(&g_traceLock);
+}
+
+int tracing_enabled(void)
+{
+    return g_traceFd >= 0;
+}
+
+unsigned long long trace_now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL + (unsigned long long)now.tv_nsec / 1000ULL;
+}
+
+void trace_set_correlation(unsigned long corr_id)
+{
+    t_corrId = corr_id;
+}
+
+unsigned long trace_correlation(void)
+{
+    return t_corrId;
+}
+
+void trace_span(const char* name, const char* cat, unsigned long long start_us, unsigned long long end_us)
+{
+    trace_span_on(name, cat, (long)getpid(), current_tid(), start_us, end_us);
+}
+
+void trace_span_on(const char* name, const char* cat, long pid, long tid,
+                   unsigned long long start_us, unsigned long long end_us)
+{
+    if (!tracing_enabled()) {
+        return;
+    }
+    TraceEvent ev = { name, cat, 'X', start_us, end_us > start_us ? end_us - start_us : 0,
+                      pid, tid, t_corrId };
+    record_event(&ev);
+}
+
+void trace_async(const char* name, const char* cat, unsigned long long start_us, unsigned long long end_us)
+{
+    if (!tracing_enabled()) {
+        return;
+    }
+    TraceEvent ev = { name, cat, 'b', start_us, end_us > start_us ? end_us - start_us : 0,
+                      (long)getpid(), current_tid(), t_corrId };
+    record_event(&ev);
+}
+
+void trace_flow(char phase, unsigned long long ts_us)
+{
+    if (!tracing_enabled()) {
+        return;
+    }
+    TraceEvent ev = { "command", "flow", phase, ts_us, 0, (long)getpid(), current_tid(), t_corrId };
+    record_event(&ev);
+}
+
+void trace_thread_name(const char* name)
+{
+    if (!tracing_enabled()) {
+        return;
+    }
+    TraceEvent ev = { name, "meta", 'M', 0, 0, (long)getpid(), current_tid(), 0 };
+    record_event(&ev);
+}